@@ -0,0 +1,220 @@
+/**
+  Capacity planner of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "CapacityPlanner.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <fmt/core.h>
+#include "FrameCodec.h"
+#include "PacerClock.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+static const double megabyte = 1024.0 * 1024.0;
+static const double encodeSeconds = 2;    // Length of each encoding measurement.
+static const double writeSeconds = 3;     // Length of the write measurement, unless maxWriteBytes come first.
+static const uint64_t maxWriteBytes = 2ull << 30;
+static const size_t writeBlockBytes = 4 << 20;
+static const double minStallSeconds = 0.5;     // A streaming buffer rides out at least this long a disk stall.
+static const double streamingHeadroom = 1.1;   // Streaming must be this much faster than the target frame rate.
+static const double memoryShare = 0.8;         // Share of the available memory the buffer may take.
+
+
+int bufferLengthForMemory(const double memoryMB, const double frameBytes) {
+	return max(2, (int)floor(memoryMB * megabyte / frameBytes));
+}
+
+
+/// Physical memory available without swapping, 0 if unknown.
+static double availableMemoryBytes() {
+#ifdef __linux__
+	ifstream meminfo("/proc/meminfo");
+	string key, unit;
+	double kilobytes;
+	while (meminfo >> key >> kilobytes) {
+		getline(meminfo, unit);
+		if (key == "MemAvailable:")
+			return kilobytes * 1024;
+	}
+	return 0;
+#elif defined(_WIN32)
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) ? (double)status.ullAvailPhys : 0;
+#else
+	return 0;
+#endif
+}
+
+
+struct EncodingSpeed {
+	double framesPerSec = 0;
+	double bytesPerFrame = 0;
+};
+
+
+/// <summary>
+/// Encode sample frames on several threads at once for encodeSeconds. The samples differ only by their noise, like
+///   consecutive frames of a static scene, so that temporal coding is measured fairly too.
+/// </summary>
+static EncodingSpeed measureEncoding(const CapacityPlanSettings& settings, const int threads) {
+	vector<cv::Mat> samples;
+	for (int seed = 0; seed < 8; ++seed)
+		samples.push_back(sampleCameraFrame(settings.frameSize, settings.bufferType, 0x5eed + seed));
+	std::atomic<int> nextFrame{ 0 };
+	std::atomic<long long> encodedBytes{ 0 };
+	std::atomic<bool> stop{ false };
+	auto encodeFrames = [&]() {
+		vector<uchar> encoded;
+		while (!stop.load(std::memory_order_relaxed)) {
+			const int frameID = nextFrame++;
+			settings.encode(samples[frameID % samples.size()], frameID, encoded);
+			encodedBytes += (long long)encoded.size();
+		}
+	};
+	const double t0 = pacerNow();
+	vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i)
+		workers.emplace_back(encodeFrames);
+	std::this_thread::sleep_for(std::chrono::duration<double>(encodeSeconds));
+	stop = true;
+	for (std::thread& t : workers)
+		t.join();
+	const double seconds = pacerNow() - t0;
+	EncodingSpeed speed;
+	speed.framesPerSec = nextFrame / seconds;
+	speed.bytesPerFrame = nextFrame > 0 ? (double)encodedBytes / nextFrame : 0;
+	return speed;
+}
+
+
+struct WriteSpeed {
+	double bytesPerSec = 0;
+	double longestWrite = 0;  // Seconds of the slowest single write, where writeback throttling shows up.
+	bool ok = false;
+};
+
+
+/// <summary>
+/// Write random data to the scratch file with the storage settings of the session, flush it to storage, and
+///   delete it. Random data, so that a compressing file system does not make the write look cheaper.
+/// </summary>
+static WriteSpeed measureWriting(const CapacityPlanSettings& settings) {
+	WriteSpeed speed;
+	StorageWriter writer(settings.storage);
+	if (!writer.open(settings.scratchPath))
+		return speed;
+	vector<uchar> block(writeBlockBytes);
+	cv::RNG rng(0x5eed);
+	for (uchar& b : block)
+		b = (uchar)rng.uniform(0, 256);
+	uint64_t written = 0;
+	bool ok = true;
+	const double t0 = pacerNow();
+	while (ok && written < maxWriteBytes && pacerNow() - t0 < writeSeconds) {
+		const double start = pacerNow();
+		ok = writer.write(block.data(), block.size());
+		speed.longestWrite = max(speed.longestWrite, pacerNow() - start);
+		written += block.size();
+	}
+	ok = writer.sync() && ok;
+	const double seconds = pacerNow() - t0;
+	ok = writer.close() && ok;
+	remove(settings.scratchPath.c_str());
+	speed.bytesPerSec = written / seconds;
+	speed.ok = ok;
+	return speed;
+}
+
+
+bool planCapacity(const CapacityPlanSettings& settings) {
+	const double frameBytes = (double)settings.frameSize.area() * CV_ELEM_SIZE(settings.bufferType);
+	const double target = settings.targetFps;
+	const int numFrames = (int)(target * settings.recordTimeSeconds);
+	fmt::print("Capacity plan for {}x{} {} frames ({:.2f} MB each in the buffer), {} fps for {} s: {} frames\n\n",
+		settings.frameSize.width, settings.frameSize.height, settings.bufferType == CV_8UC2 ? "YUY2" : "BGR",
+		frameBytes / megabyte, target, settings.recordTimeSeconds, numFrames);
+
+	// Encoding, on one thread, then on as many threads as a session uses.
+	const int encoderThreads = settings.orderedEncoding ? 1 : settings.encoderThreads;
+	fmt::print("Measuring encoding ({})...\n", settings.encodingName);
+	const EncodingSpeed single = measureEncoding(settings, 1);
+	const EncodingSpeed encoding = encoderThreads > 1 ? measureEncoding(settings, encoderThreads) : single;
+	fmt::print("  {:.1f} frames/s on one thread, {:.1f} frames/s on {} encoder thread(s), {:.2f} MB per frame "
+		"(ratio {:.2f})\n", single.framesPerSec, encoding.framesPerSec, encoderThreads,
+		encoding.bytesPerFrame / megabyte, frameBytes / max(1.0, encoding.bytesPerFrame));
+
+	fmt::print("Measuring writing to {} ({})...\n", settings.scratchPath, settings.storage.summary());
+	const WriteSpeed writing = measureWriting(settings);
+	if (!writing.ok) {
+		fmt::print("Cannot write {}. Check the output folder.\n", settings.scratchPath);
+		return false;
+	}
+	const double writeFps = writing.bytesPerSec / max(1.0, encoding.bytesPerFrame);
+	fmt::print("  {:.0f} MB/s, that is {:.1f} frames/s; the slowest {} MB write took {:.0f} ms\n\n",
+		writing.bytesPerSec / megabyte, writeFps, writeBlockBytes >> 20, writing.longestWrite * 1000);
+
+	const double sustainable = min(encoding.framesPerSec, writeFps);
+	fmt::print("Sustainable frame rate while capturing: {:.1f} fps, limited by {}\n", sustainable,
+		encoding.framesPerSec <= writeFps ? "encoding (more encoder_threads or a faster encoding help)" :
+		"the disk (a more compact encoding or a faster disk helps)");
+
+	const double availableMB = availableMemoryBytes() / megabyte;
+	const double budgetMB = availableMB > 0 ? availableMB * memoryShare : 1e300;
+	if (availableMB > 0)
+		fmt::print("Available memory: {:.0f} MB, of which the buffer may take {:.0f} MB\n", availableMB, budgetMB);
+	auto fits = [&](const int frames) { return frames * frameBytes / megabyte <= budgetMB; };
+	auto bufferSettings = [&](const int frames) {
+		return fmt::format("\"io_buffer_length\": {} (or \"buffer_memory_mb\": {:.0f})", frames,
+			ceil(frames * frameBytes / megabyte));
+	};
+
+	// The depth the session needs, and the I/O path it should take.
+	int depth;
+	fmt::print("\nRecommendation: ");
+	if (sustainable >= target * streamingHeadroom) {
+		// Frames arriving during a stall of the disk, plus the ones being encoded.
+		const double stall = max(minStallSeconds, writing.longestWrite);
+		depth = min(numFrames, (int)ceil(target * stall) + encoderThreads);
+		fmt::print("stream frames to disk while capturing, with {:.0f}% headroom. A buffer of {} frames rides out "
+			"a {:.2f} s stall: {}.\n", (sustainable / target - 1) * 100, depth, stall, bufferSettings(depth));
+	}
+	else if (fits(numFrames)) {
+		depth = numFrames;
+		const double flushFps = min(writeFps, single.framesPerSec * (settings.orderedEncoding ? 1 : settings.flushThreads));
+		fmt::print("keep the whole session in memory ({:.0f} MB), since streaming cannot keep up. Saving it after "
+			"capture takes about {:.0f} s with {} flush thread(s): {}.\n", numFrames * frameBytes / megabyte,
+			numFrames / max(1e-9, flushFps), settings.orderedEncoding ? 1 : settings.flushThreads,
+			bufferSettings(depth));
+	}
+	else {
+		// Frames pile up at (target - sustainable) per second. What is left when capture ends must fit.
+		depth = min(numFrames, (int)ceil((target - sustainable) * settings.recordTimeSeconds) + encoderThreads);
+		if (fits(depth)) {
+			fmt::print("stream frames to disk with a deep buffer. Streaming falls behind by {:.1f} fps, so {} frames "
+				"are still in the buffer when capture ends: {}.\n", target - sustainable, depth, bufferSettings(depth));
+		}
+		else {
+			fmt::print("this session cannot be captured without dropping frames. It needs a buffer of {} frames "
+				"({:.0f} MB). Use a faster encoding (e.g. an archive with \"qoi\" or \"lz4\"), more encoder_threads, "
+				"a shorter session, or a lower frame rate or resolution.\n", depth, depth * frameBytes / megabyte);
+		}
+	}
+	if (settings.bufferLength > 0) {
+		fmt::print("The settings give a buffer of {} frames ({:.0f} MB), which is {}.\n", settings.bufferLength,
+			settings.bufferLength * frameBytes / megabyte, settings.bufferLength >= depth ? "enough" : "TOO SMALL");
+	}
+	return true;
+}
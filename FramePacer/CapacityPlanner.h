@@ -0,0 +1,49 @@
+/**
+  Capacity planner of VidCap Pacer. A dry run that measures, on this machine, how fast frames of the configured
+    size are encoded with the configured codec and how fast they can be written to the output folder. From that it
+    tells the sustainable frame rate, the buffer depth a session needs, and whether to stream frames to disk while
+    capturing or keep the whole session in memory.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include "StorageWriter.h"
+
+
+/// <summary>
+/// What the planner needs to know about a session. FramePacer fills it from the capture settings.
+/// </summary>
+struct CapacityPlanSettings {
+	cv::Size frameSize;
+	int bufferType = CV_8UC3;      // Type of a frame in the I/O buffer (CV_8UC2 for raw YUY2 retrieval).
+	double targetFps = 30;
+	int recordTimeSeconds = 0;
+	int encoderThreads = 1;
+	int flushThreads = 1;          // Threads saving a whole session held in memory after capture.
+	int bufferLength = 0;          // The buffer depth the settings ask for, to check it.
+	bool orderedEncoding = false;  // Frames are encoded one at a time, in order (the temporal codec).
+	std::string encodingName;      // How frames are stored, for the report.
+	// Encode a buffer frame the way a session would store it. Called from encoderThreads threads at once unless
+	//   orderedEncoding.
+	std::function<void(const cv::Mat& frame, int frameID, std::vector<uchar>& encoded)> encode;
+	std::string scratchPath;       // A file in the output folder to measure the write speed with. It is deleted.
+	StorageWriterSettings storage;
+};
+
+/// <summary>
+/// The number of buffer frames that fit in a memory budget, at least 2.
+/// </summary>
+int bufferLengthForMemory(const double memoryMB, const double frameBytes);
+
+/// <summary>
+/// Run the measurements and print the plan.
+/// </summary>
+/// <returns>False if the scratch file cannot be written.</returns>
+bool planCapacity(const CapacityPlanSettings& settings);
@@ -0,0 +1,519 @@
+/**
+  YUY2/NV12 to BGR/RGB color conversion kernels of VidCap Pacer with run-time dispatch.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "ColorConversion.h"
+#include <algorithm>
+#include <cstdint>
+#include <omp.h>
+#include <fmt/core.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VIDCAP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define VIDCAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang need the target instruction set on each function using it. MSVC does not.
+#if defined(__GNUC__) || defined(__clang__)
+#define VIDCAP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VIDCAP_TARGET(isa)
+#endif
+
+using namespace std;
+
+
+// BT.601 YUV to RGB in the same fixed point as OpenCV (modules/imgproc/src/color_yuv.simd.hpp), so that
+//   the result is bit-exact with cv::cvtColor.
+static const int ITUR_BT_601_CY = 1220542;
+static const int ITUR_BT_601_CUB = 2116026;
+static const int ITUR_BT_601_CUG = -409993;
+static const int ITUR_BT_601_CVG = -852492;
+static const int ITUR_BT_601_CVR = 1673527;
+static const int ITUR_BT_601_SHIFT = 20;
+static const int ITUR_BT_601_HALF = 1 << (ITUR_BT_601_SHIFT - 1);
+
+
+typedef void (*Yuy2RowKernel)(const uchar* src, uchar* dst, int width, bool rgb);
+typedef void (*Nv12RowKernel)(const uchar* yRow, const uchar* uvRow, uchar* dst, int width, bool rgb);
+
+
+static inline uchar clampToByte(int value) {
+	return (uchar)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+
+/// Convert two pixels sharing one U/V pair.
+static inline void convertPixelPair(int y0, int y1, int u, int v, uchar* dst, bool rgb) {
+	const int uu = u - 128;
+	const int vv = v - 128;
+	const int ruv = ITUR_BT_601_HALF + ITUR_BT_601_CVR * vv;
+	const int guv = ITUR_BT_601_HALF + ITUR_BT_601_CVG * vv + ITUR_BT_601_CUG * uu;
+	const int buv = ITUR_BT_601_HALF + ITUR_BT_601_CUB * uu;
+	const int bIdx = rgb ? 2 : 0;
+	const int ys[2] = { y0, y1 };
+	for (int k = 0; k < 2; ++k) {
+		const int y = std::max(0, ys[k] - 16) * ITUR_BT_601_CY;
+		dst[3 * k + bIdx] = clampToByte((y + buv) >> ITUR_BT_601_SHIFT);
+		dst[3 * k + 1] = clampToByte((y + guv) >> ITUR_BT_601_SHIFT);
+		dst[3 * k + (2 - bIdx)] = clampToByte((y + ruv) >> ITUR_BT_601_SHIFT);
+	}
+}
+
+
+static void yuy2RowScalar(const uchar* src, uchar* dst, int width, bool rgb) {
+	for (int x = 0; x + 1 < width; x += 2)
+		convertPixelPair(src[2 * x], src[2 * x + 2], src[2 * x + 1], src[2 * x + 3], dst + 3 * x, rgb);
+}
+
+
+static void nv12RowScalar(const uchar* yRow, const uchar* uvRow, uchar* dst, int width, bool rgb) {
+	for (int x = 0; x + 1 < width; x += 2)
+		convertPixelPair(yRow[x], yRow[x + 1], uvRow[x], uvRow[x + 1], dst + 3 * x, rgb);
+}
+
+
+#ifdef VIDCAP_X86
+
+/// pshufb masks that interleave three planes of 16 bytes into 48 bytes of packed 3-channel pixels.
+///   interleaveMasks[k][c] picks the bytes of plane c that go into output block k.
+struct InterleaveMasks {
+	alignas(16) uint8_t mask[3][3][16];
+	InterleaveMasks() {
+		for (int k = 0; k < 3; ++k)
+			for (int c = 0; c < 3; ++c)
+				for (int i = 0; i < 16; ++i) {
+					const int j = 16 * k + i;
+					mask[k][c][i] = (uint8_t)(j % 3 == c ? j / 3 : 0x80);
+				}
+	}
+};
+static const InterleaveMasks interleaveMasks;
+
+
+/// <summary>
+/// Convert 16 pixels given as 16-bit lanes: Y0..Y7 and Y8..Y15, and the U/V pairs of pixels 0..7 and 8..15
+///   as [U0 V0 U1 V1 U2 V2 U3 V3]. Each 32-bit lane of a U/V vector then holds one pair.
+/// </summary>
+VIDCAP_TARGET("sse4.1")
+static inline void convert16PixelsSse(__m128i yLo, __m128i yHi, __m128i uvLo, __m128i uvHi, uchar* dst,
+		bool rgb) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi32(ITUR_BT_601_HALF);
+	const __m128i c128 = _mm_set1_epi32(128);
+	const __m128i c16 = _mm_set1_epi32(16);
+	const __m128i cy = _mm_set1_epi32(ITUR_BT_601_CY);
+	const __m128i lowWord = _mm_set1_epi32(0xFFFF);
+
+	__m128i y[4] = { _mm_unpacklo_epi16(yLo, zero), _mm_unpackhi_epi16(yLo, zero),
+		_mm_unpacklo_epi16(yHi, zero), _mm_unpackhi_epi16(yHi, zero) };
+	for (int i = 0; i < 4; ++i)
+		y[i] = _mm_mullo_epi32(_mm_max_epi32(_mm_sub_epi32(y[i], c16), zero), cy);
+
+	__m128i ruv[2], guv[2], buv[2];
+	const __m128i uvs[2] = { uvLo, uvHi };
+	for (int i = 0; i < 2; ++i) {
+		const __m128i u = _mm_sub_epi32(_mm_and_si128(uvs[i], lowWord), c128);
+		const __m128i v = _mm_sub_epi32(_mm_srli_epi32(uvs[i], 16), c128);
+		ruv[i] = _mm_add_epi32(half, _mm_mullo_epi32(v, _mm_set1_epi32(ITUR_BT_601_CVR)));
+		guv[i] = _mm_add_epi32(half, _mm_add_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(ITUR_BT_601_CVG)),
+			_mm_mullo_epi32(u, _mm_set1_epi32(ITUR_BT_601_CUG))));
+		buv[i] = _mm_add_epi32(half, _mm_mullo_epi32(u, _mm_set1_epi32(ITUR_BT_601_CUB)));
+	}
+
+	// Pixels 2k and 2k + 1 share pair k, so each pair term is duplicated before it is added to Y.
+	__m128i planes[3];
+	const __m128i* terms[3] = { buv, guv, ruv };
+	for (int c = 0; c < 3; ++c) {
+		const __m128i* t = terms[c];
+		__m128i sum[4] = {
+			_mm_srai_epi32(_mm_add_epi32(y[0], _mm_unpacklo_epi32(t[0], t[0])), ITUR_BT_601_SHIFT),
+			_mm_srai_epi32(_mm_add_epi32(y[1], _mm_unpackhi_epi32(t[0], t[0])), ITUR_BT_601_SHIFT),
+			_mm_srai_epi32(_mm_add_epi32(y[2], _mm_unpacklo_epi32(t[1], t[1])), ITUR_BT_601_SHIFT),
+			_mm_srai_epi32(_mm_add_epi32(y[3], _mm_unpackhi_epi32(t[1], t[1])), ITUR_BT_601_SHIFT) };
+		planes[c] = _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]), _mm_packs_epi32(sum[2], sum[3]));
+	}
+	if (rgb)
+		std::swap(planes[0], planes[2]);
+
+	for (int k = 0; k < 3; ++k) {
+		__m128i out = zero;
+		for (int c = 0; c < 3; ++c) {
+			const __m128i mask = _mm_load_si128((const __m128i*)interleaveMasks.mask[k][c]);
+			out = _mm_or_si128(out, _mm_shuffle_epi8(planes[c], mask));
+		}
+		_mm_storeu_si128((__m128i*)(dst + 16 * k), out);
+	}
+}
+
+
+VIDCAP_TARGET("sse4.1")
+static void yuy2RowSse41(const uchar* src, uchar* dst, int width, bool rgb) {
+	const __m128i lowByte = _mm_set1_epi16(0x00FF);
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i*)(src + 2 * x));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(src + 2 * x + 16));
+		convert16PixelsSse(_mm_and_si128(a, lowByte), _mm_and_si128(b, lowByte),
+			_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8), dst + 3 * x, rgb);
+	}
+	yuy2RowScalar(src + 2 * x, dst + 3 * x, width - x, rgb);
+}
+
+
+VIDCAP_TARGET("sse4.1")
+static void nv12RowSse41(const uchar* yRow, const uchar* uvRow, uchar* dst, int width, bool rgb) {
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const __m128i y = _mm_loadu_si128((const __m128i*)(yRow + x));
+		const __m128i uv = _mm_loadu_si128((const __m128i*)(uvRow + x));
+		convert16PixelsSse(_mm_unpacklo_epi8(y, zero), _mm_unpackhi_epi8(y, zero),
+			_mm_unpacklo_epi8(uv, zero), _mm_unpackhi_epi8(uv, zero), dst + 3 * x, rgb);
+	}
+	nv12RowScalar(yRow + x, uvRow + x, dst + 3 * x, width - x, rgb);
+}
+
+
+/// <summary>
+/// The AVX2 version of convert16PixelsSse. Each 128-bit lane converts its own group of 16 pixels, so no
+///   instruction crosses lanes until the 96 output bytes are stored.
+/// </summary>
+VIDCAP_TARGET("avx2")
+static inline void convert32PixelsAvx2(__m256i yLo, __m256i yHi, __m256i uvLo, __m256i uvHi, uchar* dst,
+		bool rgb) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i half = _mm256_set1_epi32(ITUR_BT_601_HALF);
+	const __m256i c128 = _mm256_set1_epi32(128);
+	const __m256i c16 = _mm256_set1_epi32(16);
+	const __m256i cy = _mm256_set1_epi32(ITUR_BT_601_CY);
+	const __m256i lowWord = _mm256_set1_epi32(0xFFFF);
+
+	__m256i y[4] = { _mm256_unpacklo_epi16(yLo, zero), _mm256_unpackhi_epi16(yLo, zero),
+		_mm256_unpacklo_epi16(yHi, zero), _mm256_unpackhi_epi16(yHi, zero) };
+	for (int i = 0; i < 4; ++i)
+		y[i] = _mm256_mullo_epi32(_mm256_max_epi32(_mm256_sub_epi32(y[i], c16), zero), cy);
+
+	__m256i ruv[2], guv[2], buv[2];
+	const __m256i uvs[2] = { uvLo, uvHi };
+	for (int i = 0; i < 2; ++i) {
+		const __m256i u = _mm256_sub_epi32(_mm256_and_si256(uvs[i], lowWord), c128);
+		const __m256i v = _mm256_sub_epi32(_mm256_srli_epi32(uvs[i], 16), c128);
+		ruv[i] = _mm256_add_epi32(half, _mm256_mullo_epi32(v, _mm256_set1_epi32(ITUR_BT_601_CVR)));
+		guv[i] = _mm256_add_epi32(half, _mm256_add_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(ITUR_BT_601_CVG)),
+			_mm256_mullo_epi32(u, _mm256_set1_epi32(ITUR_BT_601_CUG))));
+		buv[i] = _mm256_add_epi32(half, _mm256_mullo_epi32(u, _mm256_set1_epi32(ITUR_BT_601_CUB)));
+	}
+
+	__m256i planes[3];
+	const __m256i* terms[3] = { buv, guv, ruv };
+	for (int c = 0; c < 3; ++c) {
+		const __m256i* t = terms[c];
+		__m256i sum[4] = {
+			_mm256_srai_epi32(_mm256_add_epi32(y[0], _mm256_unpacklo_epi32(t[0], t[0])), ITUR_BT_601_SHIFT),
+			_mm256_srai_epi32(_mm256_add_epi32(y[1], _mm256_unpackhi_epi32(t[0], t[0])), ITUR_BT_601_SHIFT),
+			_mm256_srai_epi32(_mm256_add_epi32(y[2], _mm256_unpacklo_epi32(t[1], t[1])), ITUR_BT_601_SHIFT),
+			_mm256_srai_epi32(_mm256_add_epi32(y[3], _mm256_unpackhi_epi32(t[1], t[1])), ITUR_BT_601_SHIFT) };
+		planes[c] = _mm256_packus_epi16(_mm256_packs_epi32(sum[0], sum[1]), _mm256_packs_epi32(sum[2], sum[3]));
+	}
+	if (rgb)
+		std::swap(planes[0], planes[2]);
+
+	__m256i out[3];
+	for (int k = 0; k < 3; ++k) {
+		out[k] = zero;
+		for (int c = 0; c < 3; ++c) {
+			const __m256i mask = _mm256_broadcastsi128_si256(
+				_mm_load_si128((const __m128i*)interleaveMasks.mask[k][c]));
+			out[k] = _mm256_or_si256(out[k], _mm256_shuffle_epi8(planes[c], mask));
+		}
+	}
+	// Lane 0 holds bytes 0..47 and lane 1 holds bytes 48..95 as three 16-byte blocks each.
+	_mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(out[0], out[1], 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(out[2], out[0], 0x30));
+	_mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(out[1], out[2], 0x31));
+}
+
+
+VIDCAP_TARGET("avx2")
+static void yuy2RowAvx2(const uchar* src, uchar* dst, int width, bool rgb) {
+	const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+	int x = 0;
+	for (; x + 32 <= width; x += 32) {
+		const __m256i a = _mm256_loadu_si256((const __m256i*)(src + 2 * x));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(src + 2 * x + 32));
+		// Lane 0 gets pixels 0..15 and lane 1 gets pixels 16..31.
+		const __m256i first = _mm256_permute2x128_si256(a, b, 0x20);
+		const __m256i second = _mm256_permute2x128_si256(a, b, 0x31);
+		convert32PixelsAvx2(_mm256_and_si256(first, lowByte), _mm256_and_si256(second, lowByte),
+			_mm256_srli_epi16(first, 8), _mm256_srli_epi16(second, 8), dst + 3 * x, rgb);
+	}
+	yuy2RowSse41(src + 2 * x, dst + 3 * x, width - x, rgb);
+}
+
+
+VIDCAP_TARGET("avx2")
+static void nv12RowAvx2(const uchar* yRow, const uchar* uvRow, uchar* dst, int width, bool rgb) {
+	const __m256i zero = _mm256_setzero_si256();
+	int x = 0;
+	for (; x + 32 <= width; x += 32) {
+		const __m256i y = _mm256_loadu_si256((const __m256i*)(yRow + x));
+		const __m256i uv = _mm256_loadu_si256((const __m256i*)(uvRow + x));
+		convert32PixelsAvx2(_mm256_unpacklo_epi8(y, zero), _mm256_unpackhi_epi8(y, zero),
+			_mm256_unpacklo_epi8(uv, zero), _mm256_unpackhi_epi8(uv, zero), dst + 3 * x, rgb);
+	}
+	nv12RowSse41(yRow + x, uvRow + x, dst + 3 * x, width - x, rgb);
+}
+
+
+static bool cpuSupports(const char* isa) {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (string(isa) == "sse4.1")
+		return sse41;
+	if (maxLeaf < 7 || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	if (string(isa) == "sse4.1")
+		return __builtin_cpu_supports("sse4.1");
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // VIDCAP_X86
+
+
+#ifdef VIDCAP_NEON
+
+/// <summary>
+/// Convert 32 pixels: 16 U/V pairs, with the Y of the even and odd pixels of each pair.
+/// </summary>
+static inline void convert32PixelsNeon(uint8x16_t yEven, uint8x16_t yOdd, uint8x16_t u8, uint8x16_t v8,
+		uchar* dst, bool rgb) {
+	const int32x4_t half = vdupq_n_s32(ITUR_BT_601_HALF);
+	const int16x8_t c128 = vdupq_n_s16(128);
+
+	// Widen to four groups of 4 lanes.
+	const int16x8_t u16[2] = { vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(u8))), c128),
+		vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(u8))), c128) };
+	const int16x8_t v16[2] = { vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v8))), c128),
+		vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v8))), c128) };
+	int32x4_t ruv[4], guv[4], buv[4];
+	for (int i = 0; i < 4; ++i) {
+		const int16x4_t u4 = (i & 1) ? vget_high_s16(u16[i / 2]) : vget_low_s16(u16[i / 2]);
+		const int16x4_t v4 = (i & 1) ? vget_high_s16(v16[i / 2]) : vget_low_s16(v16[i / 2]);
+		const int32x4_t u = vmovl_s16(u4);
+		const int32x4_t v = vmovl_s16(v4);
+		ruv[i] = vmlaq_n_s32(half, v, ITUR_BT_601_CVR);
+		guv[i] = vmlaq_n_s32(vmlaq_n_s32(half, v, ITUR_BT_601_CVG), u, ITUR_BT_601_CUG);
+		buv[i] = vmlaq_n_s32(half, u, ITUR_BT_601_CUB);
+	}
+
+	uint8x16_t planes[2][3];  // [even/odd pixel][b, g, r]
+	const uint8x16_t ys[2] = { yEven, yOdd };
+	for (int p = 0; p < 2; ++p) {
+		const uint8x16_t yMinus16 = vqsubq_u8(ys[p], vdupq_n_u8(16));  // max(0, Y - 16)
+		const uint16x8_t y16[2] = { vmovl_u8(vget_low_u8(yMinus16)), vmovl_u8(vget_high_u8(yMinus16)) };
+		int32x4_t y[4];
+		for (int i = 0; i < 4; ++i) {
+			const uint16x4_t y4 = (i & 1) ? vget_high_u16(y16[i / 2]) : vget_low_u16(y16[i / 2]);
+			y[i] = vmulq_n_s32(vreinterpretq_s32_u32(vmovl_u16(y4)), ITUR_BT_601_CY);
+		}
+		const int32x4_t* terms[3] = { buv, guv, ruv };
+		for (int c = 0; c < 3; ++c) {
+			int16x4_t narrow[4];
+			for (int i = 0; i < 4; ++i)
+				narrow[i] = vqmovn_s32(vshrq_n_s32(vaddq_s32(y[i], terms[c][i]), ITUR_BT_601_SHIFT));
+			planes[p][c] = vcombine_u8(vqmovun_s16(vcombine_s16(narrow[0], narrow[1])),
+				vqmovun_s16(vcombine_s16(narrow[2], narrow[3])));
+		}
+	}
+
+	uint8x16x3_t out[2];
+	for (int c = 0; c < 3; ++c) {
+		const int dstChannel = rgb ? 2 - c : c;
+		const uint8x16x2_t zipped = vzipq_u8(planes[0][c], planes[1][c]);
+		out[0].val[dstChannel] = zipped.val[0];
+		out[1].val[dstChannel] = zipped.val[1];
+	}
+	vst3q_u8(dst, out[0]);
+	vst3q_u8(dst + 48, out[1]);
+}
+
+
+static void yuy2RowNeon(const uchar* src, uchar* dst, int width, bool rgb) {
+	int x = 0;
+	for (; x + 32 <= width; x += 32) {
+		const uint8x16x4_t yuyv = vld4q_u8(src + 2 * x);  // Y0, U, Y1, V
+		convert32PixelsNeon(yuyv.val[0], yuyv.val[2], yuyv.val[1], yuyv.val[3], dst + 3 * x, rgb);
+	}
+	yuy2RowScalar(src + 2 * x, dst + 3 * x, width - x, rgb);
+}
+
+
+static void nv12RowNeon(const uchar* yRow, const uchar* uvRow, uchar* dst, int width, bool rgb) {
+	int x = 0;
+	for (; x + 32 <= width; x += 32) {
+		const uint8x16x2_t y = vld2q_u8(yRow + x);
+		const uint8x16x2_t uv = vld2q_u8(uvRow + x);
+		convert32PixelsNeon(y.val[0], y.val[1], uv.val[0], uv.val[1], dst + 3 * x, rgb);
+	}
+	nv12RowScalar(yRow + x, uvRow + x, dst + 3 * x, width - x, rgb);
+}
+
+#endif  // VIDCAP_NEON
+
+
+struct ConversionKernel {
+	const char* name;
+	Yuy2RowKernel yuy2Row;  // nullptr means cv::cvtColor.
+	Nv12RowKernel nv12Row;
+};
+
+
+static vector<ConversionKernel> supportedKernels() {
+	vector<ConversionKernel> kernels;
+#ifdef VIDCAP_X86
+	if (cpuSupports("avx2"))
+		kernels.push_back({ "avx2", yuy2RowAvx2, nv12RowAvx2 });
+	if (cpuSupports("sse4.1"))
+		kernels.push_back({ "sse4.1", yuy2RowSse41, nv12RowSse41 });
+#endif
+#ifdef VIDCAP_NEON
+	kernels.push_back({ "neon", yuy2RowNeon, nv12RowNeon });
+#endif
+	kernels.push_back({ "scalar", yuy2RowScalar, nv12RowScalar });
+	kernels.push_back({ "opencv", nullptr, nullptr });
+	return kernels;
+}
+
+
+static ConversionKernel& activeKernel() {
+	static ConversionKernel kernel = supportedKernels().front();
+	return kernel;
+}
+
+
+static void convertYuy2WithKernel(const ConversionKernel& kernel, const cv::Mat& src, cv::Mat& dst, bool rgb) {
+	if (kernel.yuy2Row == nullptr) {
+		cv::cvtColor(src, dst, rgb ? cv::COLOR_YUV2RGB_YUY2 : cv::COLOR_YUV2BGR_YUY2);
+		return;
+	}
+	CV_Assert(src.type() == CV_8UC2 && src.cols % 2 == 0);
+	dst.create(src.rows, src.cols, CV_8UC3);
+	for (int row = 0; row < src.rows; ++row)
+		kernel.yuy2Row(src.ptr<uchar>(row), dst.ptr<uchar>(row), src.cols, rgb);
+}
+
+
+static void convertNv12WithKernel(const ConversionKernel& kernel, const cv::Mat& src, cv::Mat& dst, bool rgb) {
+	if (kernel.nv12Row == nullptr) {
+		cv::cvtColor(src, dst, rgb ? cv::COLOR_YUV2RGB_NV12 : cv::COLOR_YUV2BGR_NV12);
+		return;
+	}
+	const int height = src.rows * 2 / 3;
+	CV_Assert(src.type() == CV_8UC1 && src.cols % 2 == 0 && height % 2 == 0);
+	dst.create(height, src.cols, CV_8UC3);
+	for (int row = 0; row < height; ++row)
+		kernel.nv12Row(src.ptr<uchar>(row), src.ptr<uchar>(height + row / 2), dst.ptr<uchar>(row), src.cols, rgb);
+}
+
+
+void convertYuy2ToBgr(const cv::Mat& src, cv::Mat& dst, bool rgb) {
+	convertYuy2WithKernel(activeKernel(), src, dst, rgb);
+}
+
+
+void convertNv12ToBgr(const cv::Mat& src, cv::Mat& dst, bool rgb) {
+	convertNv12WithKernel(activeKernel(), src, dst, rgb);
+}
+
+
+bool setColorConversionKernel(const string& name) {
+	const vector<ConversionKernel> kernels = supportedKernels();
+	if (name == "auto") {
+		activeKernel() = kernels.front();
+		return true;
+	}
+	for (const ConversionKernel& kernel : kernels) {
+		if (name == kernel.name) {
+			activeKernel() = kernel;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+string colorConversionKernelName() {
+	return activeKernel().name;
+}
+
+
+vector<string> supportedColorConversionKernels() {
+	vector<string> names;
+	for (const ConversionKernel& kernel : supportedKernels())
+		names.push_back(kernel.name);
+	return names;
+}
+
+
+bool verifyColorConversionKernels() {
+	// Odd multiples of 2 exercise the scalar tails of the vector kernels.
+	const cv::Size sizes[] = { cv::Size(2, 2), cv::Size(46, 6), cv::Size(640, 480), cv::Size(1282, 722),
+		cv::Size(1920, 1080) };
+	cv::RNG rng(0x5eed);
+	bool allExact = true;
+
+	for (const ConversionKernel& kernel : supportedKernels()) {
+		bool exact = true;
+		for (const cv::Size& size : sizes) {
+			cv::Mat yuy2(size.height, size.width, CV_8UC2);
+			cv::Mat nv12(size.height * 3 / 2, size.width, CV_8UC1);
+			rng.fill(yuy2, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+			rng.fill(nv12, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+			for (int rgb = 0; rgb < 2; ++rgb) {
+				cv::Mat expected, actual;
+				cv::cvtColor(yuy2, expected, rgb ? cv::COLOR_YUV2RGB_YUY2 : cv::COLOR_YUV2BGR_YUY2);
+				convertYuy2WithKernel(kernel, yuy2, actual, rgb != 0);
+				exact = exact && cv::norm(expected, actual, cv::NORM_INF) == 0;
+				cv::cvtColor(nv12, expected, rgb ? cv::COLOR_YUV2RGB_NV12 : cv::COLOR_YUV2BGR_NV12);
+				convertNv12WithKernel(kernel, nv12, actual, rgb != 0);
+				exact = exact && cv::norm(expected, actual, cv::NORM_INF) == 0;
+			}
+		}
+
+		// Throughput on 1080p YUY2, the heaviest format we capture.
+		cv::Mat yuy2(1080, 1920, CV_8UC2), bgr;
+		rng.fill(yuy2, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		const int repeats = 20;
+		double t0 = omp_get_wtime();
+		for (int i = 0; i < repeats; ++i)
+			convertYuy2WithKernel(kernel, yuy2, bgr, false);
+		const double msPerFrame = (omp_get_wtime() - t0) * 1000 / repeats;
+		fmt::print("{:>8}: {}, 1080p YUY2 to BGR {:.3f} ms per frame\n", kernel.name,
+			exact ? "bit-exact" : "MISMATCH", msPerFrame);
+		allExact = allExact && exact;
+	}
+	return allExact;
+}
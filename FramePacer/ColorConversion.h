@@ -0,0 +1,48 @@
+/**
+  YUY2/NV12 to BGR/RGB color conversion of VidCap Pacer. The kernels give exactly the same result as
+    cv::cvtColor (BT.601 studio range, OpenCV's fixed-point coefficients), and the fastest one the CPU
+    supports (AVX2, SSE4.1, NEON, or scalar) is picked at run time.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+
+/// <summary>
+/// Convert a YUY2 frame (height x width CV_8UC2) to BGR, or RGB if rgb is true. The width must be even.
+/// src may be an ROI of a larger frame (starting at an even column), so cropping costs nothing extra.
+/// </summary>
+void convertYuy2ToBgr(const cv::Mat& src, cv::Mat& dst, bool rgb = false);
+
+/// <summary>
+/// Convert an NV12 frame to BGR, or RGB if rgb is true. src is laid out like OpenCV does it: a single
+///   CV_8UC1 Mat of (height * 3 / 2) x width, the Y plane followed by the interleaved UV plane.
+///   Width and height must be even.
+/// </summary>
+void convertNv12ToBgr(const cv::Mat& src, cv::Mat& dst, bool rgb = false);
+
+/// <summary>
+/// Select the conversion kernel by name: "auto" (the fastest one supported), "avx2", "sse4.1", "neon",
+///   "scalar", or "opencv" (cv::cvtColor).
+/// </summary>
+/// <returns>False if the kernel is unknown or not supported by this CPU. The selection is then unchanged.</returns>
+bool setColorConversionKernel(const std::string& name);
+
+/// Name of the kernel in use.
+std::string colorConversionKernelName();
+
+/// Names of the kernels this CPU can run, fastest first.
+std::vector<std::string> supportedColorConversionKernels();
+
+/// <summary>
+/// Check every supported kernel against cv::cvtColor on random frames of several sizes and report the
+///   throughput of each. Used by the --verify-color-conversion command.
+/// </summary>
+/// <returns>True if all kernels are bit-exact.</returns>
+bool verifyColorConversionKernels();
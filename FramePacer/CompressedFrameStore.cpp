@@ -0,0 +1,67 @@
+/**
+  Compressed frame store of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "CompressedFrameStore.h"
+#include <cstring>
+
+using namespace std;
+
+static const uint64_t frameAlignment = 64;  // Frames start on a cache line, so two threads never write one line.
+
+
+bool CompressedFrameStore::reserve(const size_t bytes, const int numFrames, const FrameCodec codec,
+		const bool hugePages) {
+	if (!arena.reserve(bytes, hugePages))
+		return false;
+	arena.prefault();
+	base = (unsigned char*)arena.carve(bytes);
+	capacityBytes = bytes;
+	entries.assign(numFrames, Entry());
+	frameCodec = codec;
+	used = 0;
+	framesAdded = 0;
+	return base != nullptr;
+}
+
+
+bool CompressedFrameStore::add(const int frameID, const cv::Mat& frame, const double grabTime,
+		const double retrieveTime) {
+	static const vector<int> noPngParams;
+	thread_local vector<uchar> encoded;  // One per I/O thread, so that its capacity is reused.
+	Entry& entry = entries.at(frameID);
+	entry.codec = frameCodecSupports(frameCodec, frame.type()) &&
+		encodeFrame(frameCodec, frame, encoded, noPngParams, 1) ? frameCodec : FrameCodec::Raw;
+	if (entry.codec == FrameCodec::Raw)
+		encodeFrame(FrameCodec::Raw, frame, encoded, noPngParams, 1);
+	// Claim room for the frame. A frame that does not fit claims nothing, so a smaller frame after it still can.
+	const uint64_t room = (encoded.size() + frameAlignment - 1) / frameAlignment * frameAlignment;
+	if (encoded.empty())
+		return false;
+	uint64_t offset = used.load();
+	do {
+		if (offset + room > capacityBytes)
+			return false;
+	} while (!used.compare_exchange_weak(offset, offset + room));
+	memcpy(base + offset, encoded.data(), encoded.size());
+	entry.offset = offset;
+	entry.rows = frame.rows;
+	entry.cols = frame.cols;
+	entry.type = frame.type();
+	entry.grabTime = grabTime;
+	entry.retrieveTime = retrieveTime;
+	entry.bytes = (uint32_t)encoded.size();
+	framesAdded += 1;
+	return true;
+}
+
+
+bool CompressedFrameStore::get(const int frameID, cv::Mat& frame) const {
+	if (!contains(frameID))
+		return false;
+	const Entry& entry = entries[frameID];
+	return decodeFrame(entry.codec, base + entry.offset, entry.bytes, entry.rows, entry.cols, entry.type, frame);
+}
@@ -0,0 +1,77 @@
+/**
+  Compressed frame store of VidCap Pacer. A whole session can be held in memory compressed with a fast lossless
+    codec: frames are compressed on the I/O threads as they leave a small buffer of raw frames, and decompressed
+    when they are saved once capture is over. The same memory then holds several times more frames.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "FrameArena.h"
+#include "FrameCodec.h"
+
+
+/// <summary>
+/// Compressed frames of a session, indexed by frame ID, in one pre-faulted block of memory that is filled from the
+///   start. add() may be called from several threads at once, each with different frames; the other functions are
+///   for once every add() has returned.
+/// </summary>
+class CompressedFrameStore {
+public:
+	/// <summary>
+	/// Reserve and fault in the memory, and make room for the index of numFrames frames.
+	/// </summary>
+	/// <param name="codec">Codec of the frames. Frames it cannot take are stored raw.</param>
+	/// <returns>False if the memory cannot be reserved.</returns>
+	bool reserve(const size_t bytes, const int numFrames, const FrameCodec codec, const bool hugePages);
+
+	/// <summary>
+	/// Compress a frame into the store.
+	/// </summary>
+	/// <returns>False if the store has no room left for it.</returns>
+	bool add(const int frameID, const cv::Mat& frame, const double grabTime, const double retrieveTime);
+
+	bool contains(const int frameID) const { return frameID < (int)entries.size() && entries[frameID].bytes > 0; }
+
+	/// <summary>
+	/// Decompress a frame.
+	/// </summary>
+	/// <returns>False if the frame is not in the store.</returns>
+	bool get(const int frameID, cv::Mat& frame) const;
+
+	double grabTime(const int frameID) const { return entries[frameID].grabTime; }
+	double retrieveTime(const int frameID) const { return entries[frameID].retrieveTime; }
+
+	/// Bytes reserved, and bytes taken by the frames added.
+	size_t capacity() const { return capacityBytes; }
+	size_t size() const { return std::min((size_t)used.load(), capacityBytes); }
+
+	int framesStored() const { return framesAdded.load(); }
+
+private:
+	struct Entry {
+		uint64_t offset = 0;
+		uint32_t bytes = 0;  // 0: not in the store.
+		FrameCodec codec = FrameCodec::Raw;
+		int rows = 0;
+		int cols = 0;
+		int type = 0;
+		double grabTime = 0;
+		double retrieveTime = 0;
+	};
+
+	FrameArena arena;
+	unsigned char* base = nullptr;
+	size_t capacityBytes = 0;
+	std::vector<Entry> entries;
+	FrameCodec frameCodec = FrameCodec::Raw;
+	alignas(64) std::atomic<uint64_t> used{ 0 };
+	std::atomic<int> framesAdded{ 0 };
+};
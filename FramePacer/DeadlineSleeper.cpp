@@ -0,0 +1,141 @@
+/**
+  Absolute-deadline sleeping of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "DeadlineSleeper.h"
+#include "PacerClock.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <fmt/core.h>
+#ifdef __linux__
+#include <cerrno>
+#include <time.h>
+#endif
+
+using namespace std;
+
+// The margin never goes below the guard, which covers the time from waking up to reaching the spin loop.
+static const double marginGuard = 0.00005;
+// Per-sleep decay of the latency peak. A single late wake-up keeps the margin wide for a few hundred frames.
+static const double peakDecay = 0.98;
+
+
+DeadlineSleeper::DeadlineSleeper(const double maxMargin) : maxMargin(maxMargin) {
+}
+
+
+double DeadlineSleeper::wakeMargin() const {
+	return std::min(maxMargin, std::max(marginGuard, 1.5 * latencyPeak + marginGuard));
+}
+
+
+#ifdef __linux__
+
+static double timespecToSec(const timespec& ts) {
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/// The clock the sleeps are timed on.
+static double readSleepClock() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespecToSec(now);
+}
+
+#else
+
+using SteadyClock = std::chrono::steady_clock;
+
+
+static double readSleepClock() {
+	return std::chrono::duration<double>(SteadyClock::now().time_since_epoch()).count();
+}
+
+#endif
+
+
+void DeadlineSleeper::updateClockOffset() {
+	// The clocks may tick at slightly different rates (NTP slews the monotonic clock), so the offset is
+	//   measured again every second. Of a few pairs of readings, the one with the tightest bracket of pacer
+	//   clock reads is the least disturbed by preemption.
+	if (pacerNow() - clockOffsetTime < 1.0)
+		return;
+	double bestWidth = 1e9;
+	for (int i = 0; i < 4; ++i) {
+		const double before = pacerNow();
+		const double sleepClock = readSleepClock();
+		const double after = pacerNow();
+		if (after - before < bestWidth) {
+			bestWidth = after - before;
+			clockOffset = sleepClock - (before + after) / 2;
+			clockOffsetTime = after;
+		}
+	}
+}
+
+
+#ifdef __linux__
+
+double DeadlineSleeper::sleepUntil(const double deadline) {
+	const double wakeTime = deadline - wakeMargin();
+	updateClockOffset();
+	const double sleepTime = wakeTime - pacerNow();
+	if (sleepTime <= 0)
+		return 0;
+
+	const double target = wakeTime + clockOffset;
+	timespec wake;
+	wake.tv_sec = (time_t)target;
+	wake.tv_nsec = (long)((target - (double)wake.tv_sec) * 1e9);
+	if (wake.tv_nsec >= 1000000000L) {
+		wake.tv_sec += 1;
+		wake.tv_nsec -= 1000000000L;
+	}
+	// With TIMER_ABSTIME, a sleep interrupted by a signal is simply resumed toward the same deadline.
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr) == EINTR) {
+		continue;
+	}
+
+	const double latency = std::max(0.0, pacerNow() - wakeTime);
+	latencyPeak = std::max(latency, latencyPeak * peakDecay);
+	latencySum += latency;
+	latencyMax = std::max(latencyMax, latency);
+	sleepCount += 1;
+	return sleepTime;
+}
+
+#else
+
+double DeadlineSleeper::sleepUntil(const double deadline) {
+	const double wakeTime = deadline - wakeMargin();
+	updateClockOffset();
+	const double sleepTime = wakeTime - pacerNow();
+	if (sleepTime <= 0)
+		return 0;
+
+	const SteadyClock::time_point wake(
+		std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(wakeTime + clockOffset)));
+	std::this_thread::sleep_until(wake);
+
+	const double latency = std::max(0.0, pacerNow() - wakeTime);
+	latencyPeak = std::max(latency, latencyPeak * peakDecay);
+	latencySum += latency;
+	latencyMax = std::max(latencyMax, latency);
+	sleepCount += 1;
+	return sleepTime;
+}
+
+#endif
+
+
+std::string DeadlineSleeper::latencySummary() const {
+	if (sleepCount == 0)
+		return "no sleeps";
+	return fmt::format("{} sleeps, mean {:.1f} us, max {:.1f} us, final spin margin {:.1f} us",
+		sleepCount, latencySum / sleepCount * 1e6, latencyMax * 1e6, wakeMargin() * 1e6);
+}
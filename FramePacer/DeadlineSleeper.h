@@ -0,0 +1,57 @@
+/**
+  Absolute-deadline sleeping of VidCap Pacer. The frame grabbing thread sleeps to just before the ideal grabbing
+    time with microsecond resolution and spins only for the residual, which is sized from the wake-up latency
+    measured on this machine.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <string>
+
+
+/// <summary>
+/// Sleeps to an absolute deadline on the monotonic clock: clock_nanosleep(TIMER_ABSTIME) on Linux,
+///   std::this_thread::sleep_until elsewhere. The deadline is given on the pacer clock and mapped to the
+///   monotonic clock with an offset measured from tightly paired readings of both, so an absolute deadline does
+///   not drift when the thread is preempted before it goes to sleep, and it is not truncated to milliseconds.
+/// After each sleep, the sleeper measures how late the thread woke up. The wake-up margin (how early it aims
+///   to wake before the deadline) follows a slowly decaying peak of those latencies, so the caller spins
+///   only for about the worst recent latency instead of a fixed rough margin.
+/// One sleeper serves one thread.
+/// </summary>
+class DeadlineSleeper {
+public:
+	/// <param name="maxMargin">Upper bound of the wake-up margin in seconds, normally precap_rough_margin_time.</param>
+	explicit DeadlineSleeper(const double maxMargin);
+
+	/// <summary>
+	/// Sleep until the wake-up margin before a deadline on the pacer clock (a pacerNow() time, in seconds).
+	///   Nothing happens if the deadline is closer than the margin.
+	/// </summary>
+	/// <returns>The time slept in seconds.</returns>
+	double sleepUntil(const double deadline);
+
+	/// Change the upper bound of the wake-up margin, e.g. when the rough margin is being calibrated.
+	void setMaxMargin(const double margin) { maxMargin = margin; }
+
+	/// Current wake-up margin in seconds.
+	double wakeMargin() const;
+
+	/// Summary of the measured wake-up latencies, e.g. for the end-of-capture report.
+	std::string latencySummary() const;
+
+private:
+	/// Measure the offset of the monotonic clock from the pacer clock, if it was last measured a while ago.
+	void updateClockOffset();
+
+	double maxMargin;
+	double clockOffset = 0;  // Monotonic clock minus pacer clock, in seconds.
+	double clockOffsetTime = -1e9;  // Pacer time at which clockOffset was measured.
+	double latencyPeak = 0.001;  // Start conservative. The peak decays toward what the machine really does.
+	double latencySum = 0;
+	double latencyMax = 0;
+	long long sleepCount = 0;
+};
@@ -0,0 +1,302 @@
+/**
+  Frame archive of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "FrameArchive.h"
+#include "TemporalCodec.h"
+#include <cstring>
+#include <fstream>
+#include <fmt/core.h>
+
+using namespace std;
+
+// On-disk layout. All integers are little-endian, as written by the x86 and ARM machines we capture on.
+//   Segment:  SegmentHeader, then records, and in the last segment of a closed archive, the index and the footer.
+//   Record:   RecordHeader, then payloadBytes bytes.
+//   Index:    one IndexEntry per frame ID from 0 to entryCount-1 (segment -1 for a frame not in the archive).
+
+static const char segmentMagic[8] = { 'V', 'C', 'P', 'A', 'R', 'C', 'H', '1' };
+static const char recordMagic[4] = { 'V', 'C', 'P', 'F' };
+static const char footerMagic[8] = { 'V', 'C', 'P', 'I', 'N', 'D', 'E', 'X' };
+
+struct SegmentHeader {
+	char magic[8];
+	uint32_t segment;
+	uint32_t reserved;
+};
+
+struct RecordHeader {
+	char magic[4];
+	int32_t frameID;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;
+	uint32_t encoding;
+	double grabTime;
+	double retrieveTime;
+	uint64_t payloadBytes;
+};
+
+struct IndexEntry {
+	int32_t frameID;
+	int32_t segment;
+	uint64_t offset;  // Of the payload.
+	uint64_t payloadBytes;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;
+	uint32_t encoding;
+	double grabTime;
+	double retrieveTime;
+};
+
+struct Footer {
+	uint64_t indexOffset;
+	uint32_t entryCount;
+	uint32_t segmentCount;
+	char magic[8];
+};
+
+static_assert(sizeof(SegmentHeader) == 16 && sizeof(RecordHeader) == 48 && sizeof(IndexEntry) == 56 &&
+	sizeof(Footer) == 24, "The archive layout must not depend on the compiler.");
+
+
+static string segmentPath(const string& basePath, const int segment) {
+	return fmt::format("{}.{:03d}", basePath, segment);
+}
+
+
+FrameArchiveWriter::~FrameArchiveWriter() {
+	if (file != nullptr)
+		file->close();
+}
+
+
+bool FrameArchiveWriter::open(const std::string& basePath, const uint64_t segmentBytes,
+		const StorageWriterSettings& storage) {
+	file = make_unique<StorageWriter>(storage);
+	this->basePath = basePath;
+	segmentLimit = segmentBytes;
+	segmentIndex = -1;
+	totalBytes = 0;
+	index.clear();
+	// Remove the segments of an earlier archive at the same path. A leftover segment past the last one of the new
+	//   archive would be taken as its last segment, with a stale index.
+	for (int k = 0; remove(segmentPath(basePath, k).c_str()) == 0; ++k) {}
+	return startSegment();
+}
+
+
+bool FrameArchiveWriter::startSegment() {
+	if (file->isOpen() && !file->close())
+		return false;
+	segmentIndex += 1;
+	if (!file->open(segmentPath(basePath, segmentIndex)))
+		return false;
+	SegmentHeader header = {};
+	memcpy(header.magic, segmentMagic, sizeof(header.magic));
+	header.segment = (uint32_t)segmentIndex;
+	segmentBytes = sizeof(header);
+	totalBytes += sizeof(header);
+	return file->write(&header, sizeof(header));
+}
+
+
+bool FrameArchiveWriter::append(const ArchiveFrameInfo& info, const void* payload, const size_t payloadBytes) {
+	RecordHeader header;
+	memcpy(header.magic, recordMagic, sizeof(header.magic));
+	header.frameID = info.frameID;
+	header.rows = info.rows;
+	header.cols = info.cols;
+	header.type = info.type;
+	header.encoding = (uint32_t)info.encoding;
+	header.grabTime = info.grabTime;
+	header.retrieveTime = info.retrieveTime;
+	header.payloadBytes = payloadBytes;
+
+	lock_guard<mutex> lock(m);
+	if (!isOpen())
+		return false;
+	// Keep at least one record per segment, however large it is.
+	const uint64_t recordBytes = sizeof(header) + payloadBytes;
+	if (segmentBytes > sizeof(SegmentHeader) && segmentBytes + recordBytes > segmentLimit && !startSegment())
+		return false;
+	if (!file->write(&header, sizeof(header)) || !file->write(payload, payloadBytes))
+		return false;
+	ArchiveFrameInfo entry = info;
+	entry.segment = segmentIndex;
+	entry.offset = segmentBytes + sizeof(header);
+	entry.payloadBytes = payloadBytes;
+	index.push_back(entry);
+	segmentBytes += recordBytes;
+	totalBytes += recordBytes;
+	return true;
+}
+
+
+bool FrameArchiveWriter::close(const int numFrames) {
+	lock_guard<mutex> lock(m);
+	if (!isOpen())
+		return false;
+	vector<IndexEntry> entries(numFrames);
+	for (IndexEntry& e : entries)
+		e = { -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+	for (const ArchiveFrameInfo& f : index) {
+		if (f.frameID >= 0 && f.frameID < numFrames)
+			entries[f.frameID] = { f.frameID, f.segment, f.offset, f.payloadBytes, f.rows, f.cols, f.type,
+				(uint32_t)f.encoding, f.grabTime, f.retrieveTime };
+	}
+	Footer footer;
+	footer.indexOffset = segmentBytes;
+	footer.entryCount = (uint32_t)numFrames;
+	footer.segmentCount = (uint32_t)(segmentIndex + 1);
+	memcpy(footer.magic, footerMagic, sizeof(footer.magic));
+	bool ok = file->write(entries.data(), entries.size() * sizeof(IndexEntry)) && file->write(&footer, sizeof(footer));
+	ok = file->close() && ok;
+	totalBytes += entries.size() * sizeof(IndexEntry) + sizeof(footer);
+	return ok;
+}
+
+
+bool FrameArchiveReader::open(const std::string& basePath) {
+	this->basePath = basePath;
+	frames.clear();
+	indexRebuilt = false;
+	int segmentCount = 0;
+	while (ifstream(segmentPath(basePath, segmentCount), ios::binary).good())
+		segmentCount += 1;
+	if (segmentCount == 0)
+		return false;
+	if (!loadIndex(segmentCount - 1)) {
+		scanRecords(segmentCount);
+		indexRebuilt = true;
+	}
+	return true;
+}
+
+
+bool FrameArchiveReader::loadIndex(const int lastSegment) {
+	ifstream in(segmentPath(basePath, lastSegment), ios::binary);
+	Footer footer;
+	in.seekg(-(streamoff)sizeof(footer), ios::end);
+	if (!in.read((char*)&footer, sizeof(footer)) || memcmp(footer.magic, footerMagic, sizeof(footer.magic)) != 0 ||
+			(int)footer.segmentCount != lastSegment + 1)
+		return false;
+	vector<IndexEntry> entries(footer.entryCount);
+	in.seekg((streamoff)footer.indexOffset);
+	if (!entries.empty() && !in.read((char*)entries.data(), entries.size() * sizeof(IndexEntry)))
+		return false;
+	frames.resize(entries.size());
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const IndexEntry& e = entries[i];
+		ArchiveFrameInfo& f = frames[i];
+		f.frameID = (int)i;
+		f.segment = e.segment;
+		f.offset = e.offset;
+		f.payloadBytes = e.payloadBytes;
+		f.rows = e.rows;
+		f.cols = e.cols;
+		f.type = e.type;
+		f.encoding = (FrameCodec)e.encoding;
+		f.grabTime = e.grabTime;
+		f.retrieveTime = e.retrieveTime;
+	}
+	return true;
+}
+
+
+void FrameArchiveReader::scanRecords(const int segmentCount) {
+	for (int segment = 0; segment < segmentCount; ++segment) {
+		ifstream in(segmentPath(basePath, segment), ios::binary | ios::ate);
+		const uint64_t fileBytes = (uint64_t)in.tellg();
+		in.seekg(0);
+		SegmentHeader segmentHeader;
+		if (!in.read((char*)&segmentHeader, sizeof(segmentHeader)) ||
+				memcmp(segmentHeader.magic, segmentMagic, sizeof(segmentHeader.magic)) != 0)
+			continue;
+		RecordHeader header;
+		uint64_t offset = sizeof(segmentHeader);
+		// Stop at the index (or at a record cut short by a crash).
+		while (in.read((char*)&header, sizeof(header)) && memcmp(header.magic, recordMagic, sizeof(header.magic)) == 0) {
+			offset += sizeof(header);
+			if (offset + header.payloadBytes > fileBytes)
+				break;
+			in.seekg((streamoff)header.payloadBytes, ios::cur);
+			if (header.frameID >= 0) {
+				if (header.frameID >= (int)frames.size())
+					frames.resize(header.frameID + 1);
+				ArchiveFrameInfo& f = frames[header.frameID];
+				f = { header.frameID, header.rows, header.cols, header.type, (FrameCodec)header.encoding,
+					header.grabTime, header.retrieveTime, segment, offset, header.payloadBytes };
+			}
+			offset += header.payloadBytes;
+		}
+	}
+	for (int i = 0; i < (int)frames.size(); ++i)
+		frames[i].frameID = i;
+}
+
+
+bool FrameArchiveReader::readPayload(const int frameID, std::vector<uchar>& payload) const {
+	if (frameID < 0 || frameID >= (int)frames.size() || frames[frameID].segment < 0)
+		return false;
+	const ArchiveFrameInfo& f = frames[frameID];
+	ifstream in(segmentPath(basePath, f.segment), ios::binary);
+	in.seekg((streamoff)f.offset);
+	payload.resize(f.payloadBytes);
+	return (bool)in.read((char*)payload.data(), payload.size());
+}
+
+
+bool FrameArchiveReader::readFrame(const int frameID, cv::Mat& frame) const {
+	vector<uchar> payload;
+	if (!readPayload(frameID, payload))
+		return false;
+	const ArchiveFrameInfo& f = frames[frameID];
+	if (f.encoding == FrameCodec::Temporal)
+		return readTemporalFrame(frameID, payload, frame);
+	return decodeFrame(f.encoding, payload.data(), payload.size(), f.rows, f.cols, f.type, frame);
+}
+
+
+bool FrameArchiveReader::readTemporalFrame(const int frameID, std::vector<uchar>& payload, cv::Mat& frame) const {
+	lock_guard<mutex> lock(temporalMutex);
+	if (frameID == cachedID) {
+		cachedFrame.copyTo(frame);
+		return true;
+	}
+	// Walk back to a key frame or to the frame decoded last, then decode forward.
+	vector<int> chain = { frameID };
+	vector<vector<uchar>> payloads;
+	payloads.push_back(std::move(payload));
+	for (;;) {
+		const int ref = temporalReference(payloads.back().data(), payloads.back().size());
+		if (ref < 0 || ref == cachedID)
+			break;
+		// Spilled frames are encoded last, so a reference may have a larger frame ID. A reference that is not a
+		//   temporal frame of the archive, or a chain longer than the archive (a loop), means corruption.
+		if (ref >= frameCount() || frames[ref].segment < 0 || frames[ref].encoding != FrameCodec::Temporal ||
+				chain.size() >= frames.size())
+			return false;
+		chain.push_back(ref);
+		payloads.emplace_back();
+		if (!readPayload(ref, payloads.back()))
+			return false;
+	}
+	for (int i = (int)chain.size() - 1; i >= 0; --i) {
+		const ArchiveFrameInfo& f = frames[chain[i]];
+		cv::Mat decoded;
+		if (!decodeTemporalFrame(payloads[i].data(), payloads[i].size(), f.rows, f.cols, f.type, cachedFrame,
+				decoded)) {
+			cachedID = -1;
+			return false;
+		}
+		cachedFrame = decoded;
+		cachedID = chain[i];
+	}
+	cachedFrame.copyTo(frame);  // The cache stays the reference of the next frame, whatever the caller does.
+	return true;
+}
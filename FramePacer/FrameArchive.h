@@ -0,0 +1,136 @@
+/**
+  Frame archive of VidCap Pacer. Instead of one image file per frame, every encoded frame and its time stamps are
+    appended to a single archive, split into segments of bounded size. A trailing index gives any frame in O(1),
+    and --extract-archive turns an archive back into the usual image sequence.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FrameCodec.h"
+#include "StorageWriter.h"
+
+/// Metadata of a frame in an archive.
+struct ArchiveFrameInfo {
+	int frameID = -1;
+	int rows = 0;
+	int cols = 0;
+	int type = 0;
+	FrameCodec encoding = FrameCodec::Raw;
+	double grabTime = 0;      // Seconds from the start of capture, as in the time stamp report.
+	double retrieveTime = 0;
+	int segment = -1;         // -1 if the archive has no such frame.
+	uint64_t offset = 0;      // Offset of the payload in its segment.
+	uint64_t payloadBytes = 0;
+};
+
+
+/// <summary>
+/// Writes an archive. Segment k of the archive at basePath is the file basePath.k (k with 3 digits). Each segment
+///   starts with a small header and holds frame records: a fixed header with the frame metadata followed by the
+///   payload. Records are appended in whatever order the encoders finish. On close, an index of every frame,
+///   ordered by frame ID, and a footer pointing to it are appended to the last segment.
+/// append() is safe to call from several encoder threads. Encode outside of it; it only copies bytes.
+/// </summary>
+class FrameArchiveWriter {
+public:
+	FrameArchiveWriter() = default;
+	~FrameArchiveWriter();
+	FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+	FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+	/// <summary>
+	/// Create an archive. An archive already at basePath is replaced, all of its segments removed.
+	/// </summary>
+	/// <param name="segmentBytes">A new segment is started before a record would make a segment larger.</param>
+	/// <param name="storage">How the segments are written to storage.</param>
+	/// <returns>False if the first segment cannot be created.</returns>
+	bool open(const std::string& basePath, const uint64_t segmentBytes,
+		const StorageWriterSettings& storage = StorageWriterSettings());
+
+	bool isOpen() const { return file != nullptr && file->isOpen(); }
+
+	/// <summary>
+	/// Append a frame record. info.segment and info.offset are ignored.
+	/// </summary>
+	/// <returns>False if the archive cannot be written.</returns>
+	bool append(const ArchiveFrameInfo& info, const void* payload, const size_t payloadBytes);
+
+	/// <summary>
+	/// Append the index of frames 0 to numFrames-1 and close the archive.
+	/// </summary>
+	/// <returns>False if the index cannot be written.</returns>
+	bool close(const int numFrames);
+
+	int framesWritten() const { return (int)index.size(); }
+	uint64_t bytesWritten() const { return totalBytes; }
+	int segmentCount() const { return segmentIndex + 1; }
+
+private:
+	bool startSegment();
+
+	std::mutex m;
+	std::string basePath;
+	uint64_t segmentLimit = 0;
+	std::unique_ptr<StorageWriter> file;
+	int segmentIndex = -1;
+	uint64_t segmentBytes = 0;
+	uint64_t totalBytes = 0;
+	std::vector<ArchiveFrameInfo> index;
+};
+
+
+/// <summary>
+/// Reads an archive. The index is loaded from the footer of the last segment. An archive whose writer did not
+///   close it (e.g. after a crash) has no index, so its records are scanned instead.
+/// read() is safe to call from several threads.
+/// </summary>
+class FrameArchiveReader {
+public:
+	/// <returns>False if there is no archive at basePath.</returns>
+	bool open(const std::string& basePath);
+
+	/// One more than the largest frame ID in the archive.
+	int frameCount() const { return (int)frames.size(); }
+
+	/// Metadata of a frame. Its segment is -1 if the archive does not hold the frame.
+	const ArchiveFrameInfo& info(const int frameID) const { return frames.at(frameID); }
+
+	/// Whether the index was rebuilt by scanning the records.
+	bool recovered() const { return indexRebuilt; }
+
+	/// <summary>
+	/// Read the payload of a frame as stored (e.g. the bytes of a PNG file).
+	/// </summary>
+	bool readPayload(const int frameID, std::vector<uchar>& payload) const;
+
+	/// <summary>
+	/// Read a frame and decode it into the Mat type it had when it was archived.
+	/// A temporal frame needs the frames it refers to, back to a key frame. The frame decoded last is kept, so
+	///   reading frames in frame order decodes each of them once. Such reads are serialized.
+	/// </summary>
+	bool readFrame(const int frameID, cv::Mat& frame) const;
+
+private:
+	bool loadIndex(const int lastSegment);
+	void scanRecords(const int segmentCount);
+	bool readTemporalFrame(const int frameID, std::vector<uchar>& payload, cv::Mat& frame) const;
+
+	std::string basePath;
+	std::vector<ArchiveFrameInfo> frames;
+	bool indexRebuilt = false;
+
+	// The temporal frame decoded last.
+	mutable std::mutex temporalMutex;
+	mutable int cachedID = -1;
+	mutable cv::Mat cachedFrame;
+};
+
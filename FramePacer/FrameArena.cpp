@@ -0,0 +1,151 @@
+/**
+  Frame arena of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "FrameArena.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+static const size_t hugePageBytes = 2 << 20;
+static const size_t smallPageBytes = 4096;
+static const size_t prefaultBytesPerThread = 256 << 20;  // Smaller blocks are faulted in on one thread.
+
+
+static size_t roundUp(const size_t bytes, const size_t unit) {
+	return (bytes + unit - 1) / unit * unit;
+}
+
+
+FrameArena::~FrameArena() {
+	release();
+}
+
+
+#ifdef _WIN32
+
+bool FrameArena::reserve(const size_t size, const bool hugePages) {
+	release();
+	bytes = max(size, pieceAlignment);
+	// Large pages need SeLockMemoryPrivilege. They are locked and committed at once, so there is nothing to fault in.
+	const size_t largePage = GetLargePageMinimum();
+	if (hugePages && largePage > 0) {
+		mappedBytes = roundUp(bytes, largePage);
+		base = (unsigned char*)VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+			PAGE_READWRITE);
+		if (base != nullptr) {
+			pages = Pages::Huge;
+			return true;
+		}
+	}
+	mappedBytes = roundUp(bytes, smallPageBytes);
+	base = (unsigned char*)VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	pages = Pages::Normal;
+	return base != nullptr;
+}
+
+
+void FrameArena::release() {
+	if (base != nullptr)
+		VirtualFree(base, 0, MEM_RELEASE);
+	base = nullptr;
+	bytes = mappedBytes = used = 0;
+}
+
+#else
+
+bool FrameArena::reserve(const size_t size, const bool hugePages) {
+	release();
+	bytes = max(size, pieceAlignment);
+	void* block = MAP_FAILED;
+	if (hugePages) {
+		mappedBytes = roundUp(bytes, hugePageBytes);
+#ifdef MAP_HUGETLB
+		// Only succeeds if enough huge pages are reserved (vm.nr_hugepages).
+		block = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		pages = Pages::Huge;
+#endif
+		if (block == MAP_FAILED) {
+			block = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			pages = Pages::Normal;
+#ifdef MADV_HUGEPAGE
+			if (block != MAP_FAILED && madvise(block, mappedBytes, MADV_HUGEPAGE) == 0)
+				pages = Pages::Transparent;
+#endif
+		}
+	}
+	else {
+		mappedBytes = roundUp(bytes, smallPageBytes);
+		block = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		pages = Pages::Normal;
+	}
+	if (block == MAP_FAILED) {
+		bytes = mappedBytes = 0;
+		return false;
+	}
+	base = (unsigned char*)block;
+	return true;
+}
+
+
+void FrameArena::release() {
+	if (base != nullptr)
+		munmap(base, mappedBytes);
+	base = nullptr;
+	bytes = mappedBytes = used = 0;
+}
+
+#endif
+
+
+void* FrameArena::carve(const size_t size) {
+	const size_t piece = pieceSize(size);
+	if (base == nullptr || used + piece > mappedBytes)
+		return nullptr;
+	void* p = base + used;
+	used += piece;
+	return p;
+}
+
+
+int FrameArena::prefault() {
+	if (base == nullptr)
+		return 0;
+	const size_t hardwareThreads = max(1u, std::thread::hardware_concurrency());
+	const int threads = (int)min(hardwareThreads, max((size_t)1, mappedBytes / prefaultBytesPerThread));
+	// Whole pages per thread, so that no page is touched by two threads.
+	const size_t pagesPerThread = (mappedBytes / smallPageBytes + threads - 1) / threads;
+	auto touch = [this, pagesPerThread](const int part) {
+		const size_t begin = part * pagesPerThread * smallPageBytes;
+		const size_t end = min(mappedBytes, begin + pagesPerThread * smallPageBytes);
+		volatile unsigned char* p = base;
+		for (size_t offset = begin; offset < end; offset += smallPageBytes)
+			p[offset] = 0;  // A write, so that the page is not mapped to the shared zero page.
+	};
+	vector<std::thread> workers;
+	for (int part = 1; part < threads; ++part)
+		workers.emplace_back(touch, part);
+	touch(0);
+	for (std::thread& t : workers)
+		t.join();
+	return threads;
+}
+
+
+const char* FrameArena::pageKind() const {
+	switch (pages) {
+	case Pages::Huge: return "huge pages";
+	case Pages::Transparent: return "transparent huge pages";
+	default: return "normal pages";
+	}
+}
@@ -0,0 +1,67 @@
+/**
+  Frame arena of VidCap Pacer. The frame buffer is one contiguous block of memory, optionally on huge pages, that
+    is faulted in before capture starts. Buffer slots are carved out of it, so the frame grabbing thread never takes
+    a first-touch page fault on a slot, and a buffer of many gigabytes is faulted in on every core at once.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <cstddef>
+
+
+/// <summary>
+/// A block of memory reserved once and carved into pieces that live as long as the arena. A piece is 4 KB
+///   aligned, so neighbouring slots never share a page or a cache line.
+/// </summary>
+class FrameArena {
+public:
+	FrameArena() = default;
+	~FrameArena();
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	/// <summary>
+	/// Release the memory held, and reserve a new block. With hugePages, 2 MB pages are tried first: reserved
+	///   huge pages (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows), then transparent huge pages on Linux.
+	///   Otherwise, or if the OS refuses, the block is on normal pages.
+	/// </summary>
+	/// <param name="bytes">Size of the block. Each piece takes its size rounded up to 4 KB.</param>
+	/// <param name="hugePages">Whether to try huge pages.</param>
+	/// <returns>False if the memory cannot be reserved.</returns>
+	bool reserve(const size_t bytes, const bool hugePages);
+
+	/// <summary>
+	/// The next piece of the block, or nullptr if the block has no room left.
+	/// </summary>
+	void* carve(const size_t bytes);
+
+	/// <summary>
+	/// Touch every page of the block, on several threads if it is large, so that none is faulted in later.
+	/// </summary>
+	/// <returns>The number of threads used.</returns>
+	int prefault();
+
+	/// Bytes reserved.
+	size_t size() const { return bytes; }
+
+	/// Description of the pages backing the block, e.g. "huge pages".
+	const char* pageKind() const;
+
+	/// Round bytes up to the alignment of a piece.
+	static size_t pieceSize(const size_t bytes) { return (bytes + pieceAlignment - 1) / pieceAlignment * pieceAlignment; }
+
+private:
+	enum class Pages { Normal, Transparent, Huge };
+	static constexpr size_t pieceAlignment = 4096;
+
+	void release();
+
+	unsigned char* base = nullptr;
+	size_t bytes = 0;
+	size_t mappedBytes = 0;  // bytes, rounded up to the page size.
+	size_t used = 0;
+	Pages pages = Pages::Normal;
+};
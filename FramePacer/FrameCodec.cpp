@@ -0,0 +1,499 @@
+/**
+  Lossless frame codecs of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "FrameCodec.h"
+#include "PacerClock.h"
+#include "TemporalCodec.h"
+#include <cstring>
+#include <fmt/core.h>
+#ifdef VIDCAP_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef VIDCAP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+
+bool parseFrameCodec(const std::string& name, FrameCodec& codec) {
+	if (name == "png")
+		codec = FrameCodec::Png;
+	else if (name == "raw")
+		codec = FrameCodec::Raw;
+	else if (name == "qoi")
+		codec = FrameCodec::Qoi;
+	else if (name == "temporal")
+		codec = FrameCodec::Temporal;
+#ifdef VIDCAP_WITH_LZ4
+	else if (name == "lz4")
+		codec = FrameCodec::Lz4;
+#endif
+#ifdef VIDCAP_WITH_ZSTD
+	else if (name == "zstd")
+		codec = FrameCodec::Zstd;
+#endif
+	else
+		return false;
+	return true;
+}
+
+
+const char* frameCodecName(const FrameCodec codec) {
+	switch (codec) {
+	case FrameCodec::Png: return "png";
+	case FrameCodec::Raw: return "raw";
+	case FrameCodec::Qoi: return "qoi";
+	case FrameCodec::Lz4: return "lz4";
+	case FrameCodec::Zstd: return "zstd";
+	case FrameCodec::Temporal: return "temporal";
+	}
+	return "unknown";
+}
+
+
+vector<string> availableFrameCodecs() {
+	vector<string> names = { "png", "raw", "qoi", "temporal" };
+#ifdef VIDCAP_WITH_LZ4
+	names.push_back("lz4");
+#endif
+#ifdef VIDCAP_WITH_ZSTD
+	names.push_back("zstd");
+#endif
+	return names;
+}
+
+
+bool frameCodecSupports(const FrameCodec codec, const int type) {
+	if (codec == FrameCodec::Qoi)
+		return type == CV_8UC3;
+	if (codec == FrameCodec::Png)
+		return CV_MAT_CN(type) != 2;
+	return true;
+}
+
+
+cv::Mat frameAsImage(const cv::Mat& frame) {
+	return frame.channels() == 2 ? frame.reshape(1) : frame;
+}
+
+
+cv::Mat imageAsFrame(const cv::Mat& image, const int type) {
+	if (CV_MAT_CN(type) == 2 && image.channels() == 1 && image.cols % 2 == 0)
+		return image.reshape(2);
+	return image;
+}
+
+
+// ===== QOI (https://qoiformat.org), 3-channel images only =====
+// The payload is a complete QOI file, so an extracted payload opens in any QOI viewer. QOI stores RGB, and our
+//   frames are BGR, so the channels are swapped on the way in and out.
+
+namespace {
+
+const uchar qoiOpIndex = 0x00;
+const uchar qoiOpDiff = 0x40;
+const uchar qoiOpLuma = 0x80;
+const uchar qoiOpRun = 0xc0;
+const uchar qoiOpRgb = 0xfe;
+const uchar qoiOpRgba = 0xff;
+const uchar qoiMask2 = 0xc0;
+const size_t qoiHeaderBytes = 14;
+const uchar qoiEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+struct QoiPixel {
+	uchar r, g, b, a;
+	bool operator==(const QoiPixel& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+};
+
+inline int qoiHash(const QoiPixel& p) {
+	return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) & 63;
+}
+
+inline void putBigEndian32(uchar* p, const uint32_t v) {
+	p[0] = (uchar)(v >> 24);
+	p[1] = (uchar)(v >> 16);
+	p[2] = (uchar)(v >> 8);
+	p[3] = (uchar)v;
+}
+
+inline uint32_t getBigEndian32(const uchar* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+}
+
+
+static void encodeQoi(const cv::Mat& bgr, vector<uchar>& out) {
+	// Worst case: a tag and 3 bytes per pixel.
+	out.resize(qoiHeaderBytes + bgr.total() * 4 + sizeof(qoiEndMarker));
+	uchar* o = out.data();
+	memcpy(o, "qoif", 4);
+	putBigEndian32(o + 4, (uint32_t)bgr.cols);
+	putBigEndian32(o + 8, (uint32_t)bgr.rows);
+	o[12] = 3;  // Channels
+	o[13] = 0;  // sRGB with linear alpha
+	o += qoiHeaderBytes;
+
+	QoiPixel index[64] = {};
+	QoiPixel prev = { 0, 0, 0, 255 };
+	int run = 0;
+	for (int y = 0; y < bgr.rows; ++y) {
+		const uchar* row = bgr.ptr<uchar>(y);
+		for (int x = 0; x < bgr.cols; ++x) {
+			const QoiPixel px = { row[3 * x + 2], row[3 * x + 1], row[3 * x], 255 };
+			if (px == prev) {
+				run += 1;
+				if (run == 62) {
+					*o++ = (uchar)(qoiOpRun | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				*o++ = (uchar)(qoiOpRun | (run - 1));
+				run = 0;
+			}
+			const int h = qoiHash(px);
+			if (index[h] == px) {
+				*o++ = (uchar)(qoiOpIndex | h);
+			}
+			else {
+				index[h] = px;
+				const int vr = (signed char)(px.r - prev.r);
+				const int vg = (signed char)(px.g - prev.g);
+				const int vb = (signed char)(px.b - prev.b);
+				const int vgr = vr - vg;
+				const int vgb = vb - vg;
+				if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+					*o++ = (uchar)(qoiOpDiff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+				}
+				else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+					*o++ = (uchar)(qoiOpLuma | (vg + 32));
+					*o++ = (uchar)((vgr + 8) << 4 | (vgb + 8));
+				}
+				else {
+					*o++ = qoiOpRgb;
+					*o++ = px.r;
+					*o++ = px.g;
+					*o++ = px.b;
+				}
+			}
+			prev = px;
+		}
+	}
+	if (run > 0)
+		*o++ = (uchar)(qoiOpRun | (run - 1));
+	memcpy(o, qoiEndMarker, sizeof(qoiEndMarker));
+	o += sizeof(qoiEndMarker);
+	out.resize(o - out.data());
+}
+
+
+static bool decodeQoi(const uchar* data, const size_t bytes, cv::Mat& bgr) {
+	if (bytes < qoiHeaderBytes + sizeof(qoiEndMarker) || memcmp(data, "qoif", 4) != 0 || data[12] != 3)
+		return false;
+	const int cols = (int)getBigEndian32(data + 4);
+	const int rows = (int)getBigEndian32(data + 8);
+	if (cols <= 0 || rows <= 0)
+		return false;
+	bgr.create(rows, cols, CV_8UC3);
+
+	const uchar* p = data + qoiHeaderBytes;
+	const uchar* end = data + bytes - sizeof(qoiEndMarker);
+	QoiPixel index[64] = {};
+	QoiPixel px = { 0, 0, 0, 255 };
+	int run = 0;
+	for (int y = 0; y < rows; ++y) {
+		uchar* row = bgr.ptr<uchar>(y);
+		for (int x = 0; x < cols; ++x) {
+			if (run > 0) {
+				run -= 1;
+			}
+			else {
+				if (p >= end)
+					return false;
+				const uchar b1 = *p++;
+				if (b1 == qoiOpRgb) {
+					if (end - p < 3)
+						return false;
+					px.r = p[0];
+					px.g = p[1];
+					px.b = p[2];
+					p += 3;
+				}
+				else if (b1 == qoiOpRgba) {
+					if (end - p < 4)
+						return false;
+					px = { p[0], p[1], p[2], p[3] };
+					p += 4;
+				}
+				else if ((b1 & qoiMask2) == qoiOpIndex) {
+					px = index[b1];
+				}
+				else if ((b1 & qoiMask2) == qoiOpDiff) {
+					px.r += ((b1 >> 4) & 3) - 2;
+					px.g += ((b1 >> 2) & 3) - 2;
+					px.b += (b1 & 3) - 2;
+				}
+				else if ((b1 & qoiMask2) == qoiOpLuma) {
+					if (p >= end)
+						return false;
+					const uchar b2 = *p++;
+					const int vg = (b1 & 0x3f) - 32;
+					px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+					px.g += vg;
+					px.b += vg - 8 + (b2 & 0x0f);
+				}
+				else {  // qoiOpRun
+					run = b1 & 0x3f;
+				}
+				index[qoiHash(px)] = px;
+			}
+			row[3 * x] = px.b;
+			row[3 * x + 1] = px.g;
+			row[3 * x + 2] = px.r;
+		}
+	}
+	return true;
+}
+
+
+// ===== Delta filter for the general-purpose compressors =====
+// Neighbouring pixels of a camera frame differ by a few levels, so replacing each byte with its difference from
+//   the same channel of the pixel to its left turns most bytes into small values that LZ4 and zstd compress
+//   well. The filter is applied row by row, so it also packs a frame with padded rows.
+
+#if defined(VIDCAP_WITH_LZ4) || defined(VIDCAP_WITH_ZSTD)
+
+static void deltaFilterRows(const cv::Mat& frame, vector<uchar>& filtered) {
+	const int cn = (int)frame.elemSize();
+	const size_t rowBytes = frame.cols * frame.elemSize();
+	filtered.resize(rowBytes * frame.rows);
+	for (int y = 0; y < frame.rows; ++y) {
+		const uchar* src = frame.ptr<uchar>(y);
+		uchar* dst = filtered.data() + rowBytes * y;
+		memcpy(dst, src, min<size_t>(cn, rowBytes));
+		for (size_t i = cn; i < rowBytes; ++i)
+			dst[i] = (uchar)(src[i] - src[i - cn]);
+	}
+}
+
+
+static void undoDeltaFilterRows(cv::Mat& frame) {
+	const int cn = (int)frame.elemSize();
+	const size_t rowBytes = frame.cols * frame.elemSize();
+	for (int y = 0; y < frame.rows; ++y) {
+		uchar* row = frame.ptr<uchar>(y);
+		for (size_t i = cn; i < rowBytes; ++i)
+			row[i] = (uchar)(row[i] + row[i - cn]);
+	}
+}
+
+#endif
+
+
+bool encodeFrame(const FrameCodec codec, const cv::Mat& frame, std::vector<uchar>& encoded,
+		const std::vector<int>& pngParams, const int level) {
+#ifndef VIDCAP_WITH_ZSTD
+	(void)level;  // Only zstd has levels.
+#endif
+	switch (codec) {
+	case FrameCodec::Png:
+		return cv::imencode(".png", frameAsImage(frame), encoded, pngParams);
+	case FrameCodec::Raw: {
+		const size_t rowBytes = frame.cols * frame.elemSize();
+		encoded.resize(rowBytes * frame.rows);
+		for (int y = 0; y < frame.rows; ++y)
+			memcpy(encoded.data() + rowBytes * y, frame.ptr<uchar>(y), rowBytes);
+		return true;
+	}
+	case FrameCodec::Qoi:
+		if (frame.type() != CV_8UC3)
+			return false;
+		encodeQoi(frame, encoded);
+		return true;
+#ifdef VIDCAP_WITH_LZ4
+	case FrameCodec::Lz4: {
+		thread_local vector<uchar> filtered;
+		deltaFilterRows(frame, filtered);
+		encoded.resize(LZ4_compressBound((int)filtered.size()));
+		const int n = LZ4_compress_default((const char*)filtered.data(), (char*)encoded.data(),
+			(int)filtered.size(), (int)encoded.size());
+		encoded.resize(max(n, 0));
+		return n > 0;
+	}
+#endif
+#ifdef VIDCAP_WITH_ZSTD
+	case FrameCodec::Zstd: {
+		thread_local vector<uchar> filtered;
+		deltaFilterRows(frame, filtered);
+		encoded.resize(ZSTD_compressBound(filtered.size()));
+		const size_t n = ZSTD_compress(encoded.data(), encoded.size(), filtered.data(), filtered.size(), level);
+		if (ZSTD_isError(n))
+			return false;
+		encoded.resize(n);
+		return true;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+
+bool decodeFrame(const FrameCodec codec, const uchar* data, const size_t bytes, const int rows, const int cols,
+		const int type, cv::Mat& frame) {
+	switch (codec) {
+	case FrameCodec::Png:
+		frame = imageAsFrame(cv::imdecode(vector<uchar>(data, data + bytes), cv::IMREAD_UNCHANGED), type);
+		return !frame.empty();
+	case FrameCodec::Qoi:
+		return decodeQoi(data, bytes, frame);
+	case FrameCodec::Raw:
+		frame.create(rows, cols, type);
+		if (bytes != frame.total() * frame.elemSize())
+			return false;
+		memcpy(frame.data, data, bytes);
+		return true;
+#ifdef VIDCAP_WITH_LZ4
+	case FrameCodec::Lz4: {
+		frame.create(rows, cols, type);
+		const int n = LZ4_decompress_safe((const char*)data, (char*)frame.data, (int)bytes,
+			(int)(frame.total() * frame.elemSize()));
+		if (n != (int)(frame.total() * frame.elemSize()))
+			return false;
+		undoDeltaFilterRows(frame);
+		return true;
+	}
+#endif
+#ifdef VIDCAP_WITH_ZSTD
+	case FrameCodec::Zstd: {
+		frame.create(rows, cols, type);
+		const size_t n = ZSTD_decompress(frame.data, frame.total() * frame.elemSize(), data, bytes);
+		if (ZSTD_isError(n) || n != frame.total() * frame.elemSize())
+			return false;
+		undoDeltaFilterRows(frame);
+		return true;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+
+cv::Mat sampleCameraFrame(const cv::Size& size, const int type, const int noiseSeed) {
+	// Smooth shading, horizontal in even channels and vertical in odd ones, plus a little sensor noise.
+	cv::Mat frame(size.height, size.width, type);
+	const int cn = (int)frame.elemSize();
+	for (int y = 0; y < frame.rows; ++y) {
+		uchar* p = frame.ptr<uchar>(y);
+		for (int x = 0; x < frame.cols; ++x) {
+			for (int c = 0; c < cn; ++c)
+				p[cn * x + c] = (uchar)(40 + 30 * c + (c % 2 ? 100 * y / frame.rows : 100 * x / frame.cols));
+		}
+	}
+	cv::Mat noise(frame.rows, frame.cols, type);
+	cv::RNG rng(noiseSeed);
+	rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(4), cv::Scalar::all(2));
+	frame += noise;
+	return frame;
+}
+
+
+/// <summary>
+/// Encode each frame of a sequence with codec (TemporalEncoder for Temporal, with a key frame every 4 frames),
+///   decode it back, and compare.
+/// </summary>
+/// <param name="encodedBytes">Receives the total size of the encoded frames.</param>
+/// <returns>True if every frame decodes bit-exactly.</returns>
+static bool roundTripSequence(const FrameCodec codec, const vector<cv::Mat>& sequence, size_t& encodedBytes) {
+	TemporalEncoder temporal(4);
+	vector<uchar> encoded;
+	cv::Mat decoded;
+	vector<cv::Mat> decodedFrames;
+	bool exact = true;
+	encodedBytes = 0;
+	for (int i = 0; i < (int)sequence.size(); ++i) {
+		const cv::Mat& frame = sequence[i];
+		if (codec == FrameCodec::Temporal) {
+			temporal.encode(i, frame, encoded);
+			const int ref = temporalReference(encoded.data(), encoded.size());
+			exact = exact && ref < i && decodeTemporalFrame(encoded.data(), encoded.size(), frame.rows, frame.cols,
+				frame.type(), ref >= 0 ? decodedFrames[ref] : cv::Mat(), decoded);
+		}
+		else {
+			exact = exact && encodeFrame(codec, frame, encoded, vector<int>(), 1) &&
+				decodeFrame(codec, encoded.data(), encoded.size(), frame.rows, frame.cols, frame.type(), decoded);
+		}
+		exact = exact && decoded.type() == frame.type() && decoded.rows == frame.rows &&
+			decoded.cols == frame.cols && cv::norm(frame, decoded, cv::NORM_INF) == 0;
+		decodedFrames.push_back(decoded.clone());
+		encodedBytes += encoded.size();
+	}
+	return exact;
+}
+
+
+bool verifyFrameCodecs() {
+	// Odd sizes exercise the row tails, and pure noise the worst case of each codec. Each sample is a short
+	//   sequence of the same scene with fresh sensor noise, like consecutive frames of a static scene.
+	const cv::Size sizes[] = { cv::Size(1, 1), cv::Size(3, 5), cv::Size(641, 479), cv::Size(1920, 1080) };
+	vector<vector<cv::Mat>> samples;
+	for (const cv::Size& size : sizes) {
+		for (int type : { CV_8UC3, CV_8UC2 }) {
+			samples.emplace_back();
+			for (int seed = 1; seed <= 6; ++seed)
+				samples.back().push_back(sampleCameraFrame(size, type, seed));
+		}
+	}
+	samples.emplace_back();
+	for (int seed = 1; seed <= 6; ++seed) {
+		cv::Mat noise(480, 640, CV_8UC3);
+		cv::RNG(seed).fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		samples.back().push_back(noise);
+	}
+	samples.push_back(vector<cv::Mat>(3, cv::Mat(480, 640, CV_8UC3, cv::Scalar::all(128))));
+	vector<cv::Mat> hd;  // Speed and ratio on 1080p BGR, the heaviest frames we usually save.
+	for (int seed = 1; seed <= 10; ++seed)
+		hd.push_back(sampleCameraFrame(cv::Size(1920, 1080), CV_8UC3, seed));
+
+	bool allExact = true;
+	for (const string& name : availableFrameCodecs()) {
+		FrameCodec codec;
+		parseFrameCodec(name, codec);
+		bool exact = true;
+		size_t encodedBytes;
+		for (const vector<cv::Mat>& sequence : samples) {
+			if (frameCodecSupports(codec, sequence.front().type()))
+				exact = exact && roundTripSequence(codec, sequence, encodedBytes);
+		}
+
+		const double t0 = pacerNow();
+		exact = roundTripSequence(codec, hd, encodedBytes) && exact;
+		const double seconds = pacerNow() - t0;
+		const double rawBytes = (double)hd[0].total() * hd[0].elemSize() * hd.size();
+		fmt::print("{:>8}: {}, encoding and decoding {:7.1f} MB/s per core, ratio {:5.2f}\n", name,
+			exact ? "lossless" : "MISMATCH", rawBytes / seconds / 1e6, rawBytes / encodedBytes);
+		allExact = allExact && exact;
+	}
+	// Frames no codec takes as they are, i.e. YUY2 frames for PNG and QOI, are stored as PNG of 1-channel images.
+	bool fallbackExact = true;
+	size_t encodedBytes;
+	for (const vector<cv::Mat>& sequence : samples) {
+		if (sequence.front().type() == CV_8UC2)
+			fallbackExact = roundTripSequence(FrameCodec::Png, sequence, encodedBytes) && fallbackExact;
+	}
+	fmt::print("{:>8}: {} on YUY2 frames, stored as 1-channel images\n", "png", fallbackExact ? "lossless" : "MISMATCH");
+	allExact = allExact && fallbackExact;
+	string names;
+	for (const string& name : availableFrameCodecs())
+		names += (names.empty() ? "" : ", ") + name;
+	fmt::print("Frame codecs compiled in: {}\n", names);
+	return allExact;
+}
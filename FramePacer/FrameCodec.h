@@ -0,0 +1,82 @@
+/**
+  Lossless frame codecs of VidCap Pacer. Besides PNG, frames can be stored as QOI, which encodes several times
+    faster than deflate at a similar ratio on camera frames, or compressed with LZ4 or zstd after a left-neighbour
+    delta filter. LZ4 and zstd are compiled in with VIDCAP_WITH_LZ4 and VIDCAP_WITH_ZSTD (link liblz4 and libzstd).
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// Codec of a stored frame. The values are stored in frame archives, so they must never change.
+/// Temporal frames refer to other frames, so they are encoded by TemporalEncoder, not by encodeFrame().
+enum class FrameCodec : uint32_t { Png = 1, Raw = 2, Qoi = 3, Lz4 = 4, Zstd = 5, Temporal = 6 };
+
+/// <summary>
+/// Parse a codec name ("png", "raw", "qoi", "lz4", "zstd", or "temporal").
+/// </summary>
+/// <returns>False if the name is unknown or the codec is not compiled in.</returns>
+bool parseFrameCodec(const std::string& name, FrameCodec& codec);
+
+const char* frameCodecName(const FrameCodec codec);
+
+/// Names of the codecs compiled in.
+std::vector<std::string> availableFrameCodecs();
+
+/// <summary>
+/// Whether the codec can encode frames of this Mat type as they are. QOI takes BGR frames only, and PNG has no
+///   2-channel images; the others take any frame. Frames a codec cannot take are stored as PNG, and encodeFrame()
+///   encodes a YUY2 frame as the 1-channel image of frameAsImage().
+/// </summary>
+bool frameCodecSupports(const FrameCodec codec, const int type);
+
+/// <summary>
+/// A frame as an image file can hold it. Image formats have no 2-channel images, so a YUY2 frame becomes a
+///   1-channel image twice as wide with the same bytes. Other frames are returned as they are.
+/// </summary>
+cv::Mat frameAsImage(const cv::Mat& frame);
+
+/// <summary>
+/// Undo frameAsImage(): an image read back from a file, as a frame of the given type.
+/// </summary>
+cv::Mat imageAsFrame(const cv::Mat& image, const int type);
+
+/// <summary>
+/// Encode a frame losslessly.
+/// </summary>
+/// <param name="pngParams">imwrite parameters, used by PNG.</param>
+/// <param name="level">Compression level of zstd (1 is fastest). Other codecs ignore it.</param>
+/// <returns>False if the codec cannot encode this frame (or is Temporal).</returns>
+bool encodeFrame(const FrameCodec codec, const cv::Mat& frame, std::vector<uchar>& encoded,
+	const std::vector<int>& pngParams, const int level);
+
+/// <summary>
+/// Decode a frame encoded by encodeFrame(). Raw, LZ4, and zstd payloads carry no shape, so the shape of the
+///   encoded frame is given.
+/// </summary>
+/// <returns>False if the payload is corrupt, the codec is not compiled in, or it is Temporal.</returns>
+bool decodeFrame(const FrameCodec codec, const uchar* data, const size_t bytes, const int rows, const int cols,
+	const int type, cv::Mat& frame);
+
+/// <summary>
+/// A frame that compresses like a camera frame: smooth shading plus a little sensor noise. Pure noise would not
+///   compress at all, and a noiseless frame would compress far better than any real one.
+/// </summary>
+/// <param name="noiseSeed">Seed of the noise. Frames with different seeds look like consecutive frames of a static
+///   scene.</param>
+cv::Mat sampleCameraFrame(const cv::Size& size, const int type, const int noiseSeed = 0x5eed);
+
+/// <summary>
+/// Round-trip short sequences of sample frames (BGR and YUY2, odd sizes included) through every codec compiled in
+///   that takes them, and YUY2 frames through their PNG fallback. Check that each decodes bit-exactly, and print
+///   the speed per core and the compression ratio.
+/// </summary>
+/// <returns>True if every codec is lossless on every sample.</returns>
+bool verifyFrameCodecs();
@@ -10,30 +10,54 @@
 #include <fstream>
 #include <opencv2/opencv.hpp>
 #include <memory>
-#include <omp.h>
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <limits>
 #include <fmt/core.h>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include "json.hpp"
-
-#define shrptr_VideoCapture std::shared_ptr<cv::VideoCapture> 
+#include "FrameSource.h"
+#include "V4l2FrameSource.h"
+#include "ColorConversion.h"
+#include "CompressedFrameStore.h"
+#include "FrameArena.h"
+#include "FramePool.h"
+#include "DeadlineSleeper.h"
+#include "MarginCalibrator.h"
+#include "ThreadTuning.h"
+#include "PacerClock.h"
+#include "SpillStore.h"
+#include "LiveVideoSink.h"
+#include "VideoCodec.h"
+#include "PngEncoding.h"
+#include "FrameArchive.h"
+#include "FrameCodec.h"
+#include "PrefetchPipeline.h"
+#include "TemporalCodec.h"
+#include "StorageWriter.h"
+#include "CapacityPlanner.h"
 
 using namespace cv;
 using namespace std;
 using json = nlohmann::json;
 
-shrptr_VideoCapture initVideoCapture(const int camID, const int frameHeight = 480,
+shrptr_FrameSource initVideoCapture(const int camID, const int frameHeight = 480,
 	const int frameWidth = 640, const double fps=30);
 
-void captureToMemorySpace(shrptr_VideoCapture cap, const double timeBetweenFrames,
+void captureToMemorySpace(shrptr_FrameSource cap, const double timeBetweenFrames,
 	const int numFrames, const int framesPerSec);
 
 void checkTargetFpsAgainstActualFps(const double targetFPS, const double actualFPS);
 
 void setImgFileNameFormatString(const int numFrames);
 
+bool extractArchive(string archivePath, string folder);
+
+bool planSession();
+
 void readJsonVidCaptureSettings(string configPath);
 
 void printCaptureSettings();
@@ -56,7 +80,7 @@ void printCaptureSettings();
   6. "io_buffer_length" (integer): the number of frames in a circular frame buffer. If these buffering frames >= the 
 	frames needed for the entire video series, the frame saving thread will not be created. Instead, once all frames 
 	are captured to the buffer, the frame saving function will be called to save the frames. This ensures that the 
-	I/O thread will not compete with the frame grabbing thread for any resource.
+	I/O thread will not compete with the frame grabbing thread for any resource. Optional if buffer_memory_mb is given.
 
   7. "camera_id" (non-negative integer): the camera ID regarding to the OpenCV library.
   8. "frame_height" (positive integer): frame height (pixels).
@@ -84,6 +108,178 @@ void printCaptureSettings();
   14. "video_export" (boolean): If true, once all frames are separately saved as image files, they will be read to 
 	create a single video file. The image files are preserved. This process may take a long while to finish if the 
 	recording time is long.
+
+  15. "frame_source" (string, optional): "camera" (default) grabs frames from camera_id through OpenCV. "synthetic" 
+	grabs frames from a simulated camera, which lets us benchmark and regression-test the pacer without hardware. 
+	"v4l2" (Linux only) grabs frames from /dev/video{camera_id} through V4L2 mmap buffers. When the I/O thread is used, 
+	the frames are handed to it without copying and the driver buffers are returned after the frames are saved.
+
+  16. "synthetic_camera" (object, optional): settings of the simulated camera, used when frame_source is "synthetic".
+	"sensor_frame_per_sec" is the internal frame clock of the sensor (0 follows target_frame_per_sec).
+	"grab_latency" and "retrieve_latency" are latency distributions in seconds, each with "type" ("constant", 
+	"uniform", "normal", or "lognormal"), "mean", and "spread". "stall_probability", "stall_every_n_frames", and 
+	"stall_duration" inject stalls into grabbing. "seed" makes the injected delays reproducible.
+
+  17. "v4l2_buffer_count" (positive integer, optional): the number of mmap buffers requested from a V4L2 driver 
+	(default 32). Zero-copy handoff needs io_buffer_length + 2 buffers, otherwise frames are copied as usual.
+
+  18. "capture_pixel_format" (string, optional): "bgr" (default) converts each frame to BGR (3 bytes per pixel) on the 
+	frame grabbing thread. "yuy2" keeps frames in the native YUY2 format of the device (2 bytes per pixel) in the 
+	buffer and converts them on the I/O side. This takes the conversion off the frame grabbing thread and cuts buffer 
+	memory by a third. If the device cannot deliver raw frames, VidCap Pacer falls back to "bgr".
+
+  19. "save_raw_frames" (boolean, optional): if true, YUY2 frames are saved without conversion (default false). PNG 
+	has no 2-channel images, so each frame is saved as a 1-channel PNG twice as wide holding the YUY2 bytes. This 
+	keeps the sensor data untouched and takes no conversion time at all.
+
+  20. "color_conversion" (string, optional): kernel converting YUY2 frames to BGR. "auto" (default) picks the fastest 
+	one the CPU supports. "avx2", "sse4.1", "neon", and "scalar" force a kernel, and "opencv" uses cv::cvtColor. All 
+	kernels are bit-exact with cv::cvtColor. Run "VidCapPacer --verify-color-conversion" to check and time them.
+
+  21. "sleep_mode" (string, optional): how the frame grabbing thread sleeps before the ideal grabbing time. "absolute" 
+	(default) sleeps to an absolute deadline with microsecond resolution (clock_nanosleep on Linux), measures how late 
+	the thread wakes up, and spins only for about that latency. precap_rough_margin_time is then only the largest 
+	spin allowed. "millisecond" sleeps for whole milliseconds and spins for precap_rough_margin_time, as in earlier 
+	versions.
+
+  22. "adaptive_margins" (boolean, optional): if true, precap_rough_margin_time and precap_fine_margin_time are only 
+	starting values. While capturing, VidCap Pacer watches how much time is left when the frame grabbing thread wakes 
+	up and how far each grab is from the ideal time, and adjusts both margins within safe bounds (default false).
+
+  23. "margin_calibration_file" (string, optional): a JSON file holding learned margins. If it exists, its margins 
+	replace the two precap margins above. With adaptive_margins, the margins learned in this session are written 
+	back to it, so the next session starts where this one ended.
+
+  24. "thread_tuning" (object, optional): placement and priorities of the threads, all off by default. "grab_cpus" and 
+	"io_cpus" (arrays of CPU numbers) pin the frame grabbing thread and the I/O threads, preferably to disjoint cores. 
+	"grab_sched_policy" ("other", "fifo", or "rr") and "grab_priority" run the frame grabbing thread under a real-time 
+	policy. "io_nice", "io_priority_class" ("best_effort" or "idle"), and "io_priority_level" (0-7) lower the CPU and 
+	I/O priorities of the I/O threads. "lock_memory" (boolean) locks the frame buffers in RAM so that the frame 
+	grabbing thread never takes a page fault on them. Settings the OS refuses (e.g. for lack of privileges) are 
+	reported and skipped. "encoder_cpus" (array of CPU numbers) pins each encoder thread to a single CPU, taken in 
+	turn, instead of letting all I/O threads share io_cpus.
+
+  25. "pacer_clock" (string, optional): the clock used for all frame timing. "auto" (default) picks the cheapest 
+	accurate clock available: "tsc" (invariant time stamp counter, x86), then "monotonic_raw" (Linux), then "steady" 
+	(std::chrono::steady_clock). "omp" uses omp_get_wtime as earlier versions did. Run "VidCapPacer --benchmark-clocks" 
+	to see the read cost and resolution of each clock on your machine.
+
+  26. "encoder_threads" (positive integer, optional): the number of I/O threads encoding and saving frames in parallel 
+	(default 1). Frames are still saved under their own frame IDs, and buffer slots are given back to the frame 
+	grabbing thread in frame order. Use more threads when one thread cannot encode frames as fast as they arrive, and 
+	keep at least one core free for the frame grabbing thread.
+
+  27. "overload_policy" (string, optional): what to do when the I/O buffer is full because saving frames falls behind. 
+	"drop" (default) skips storing the frame and keeps capturing. "spill" copies the frame raw into a memory-mapped 
+	scratch file once the buffer passes spill_high_water, and the I/O threads save spilled frames while capturing. 
+	"fast_encoder" switches the I/O threads to uncompressed PNG while the buffer is 
+	more than three quarters full, and drops frames if even that is not enough. Frames stored in an archive with 
+	another codec than PNG have no faster setting, so they are dropped as with "drop". "abort" stops capturing, saves the 
+	frames captured so far, and writes the reports. The time stamp report tells what became of each frame.
+
+  28. "spill_file" (string, optional): the scratch file of the "spill" policy. Default is 
+	{output_folder}/{series_name}_spill.bin. It is created at its full size (spill_capacity_mb) before capture 
+	starts, and deleted once the spilled frames are saved.
+
+  29. "video_export_mode" (string, optional): how video_export makes the video. "after" (default) reads the saved 
+	image files back once capture is over. "live" encodes each frame into the video straight from the I/O buffer 
+	while capturing, in frame order, so the video is ready when recording stops and no image file is read back. 
+	Dropped frames repeat the previous frame in both modes. In "live" mode, spilled frames are saved as images 
+	but also show up as repeated frames in the video, because they are read back only after the video is closed.
+
+  30. "save_png_frames" (boolean, optional): if false, frames are not saved as image files at all and the video is 
+	the only output (default true). This implies video_export with video_export_mode "live".
+
+  31. "video_codec" (string, optional): the video codec. "mjpg" (default) is lossy. "ffv1", "huffyuv", "png" (PNG 
+	frames in the video), and "raw" (uncompressed) are lossless, so with save_png_frames false and video_export_mode 
+	"live", a single video file written during capture replaces all image files of a session. Any other value is 
+	taken as a FourCC code, e.g. "XVID" or "mp4v". Which codecs are available depends on the OpenCV build; lossless 
+	codecs need its FFmpeg backend.
+
+  32. "export_threads" (non-negative integer, optional): the number of threads reading image files back for the 
+	video export after capture (default 0, one less than the number of logical CPUs). They read a few frames ahead 
+	of the video encoder, which gets the frames in order, so frame N+k is read from disk while frame N is encoded.
+
+  33. "video_container" (string, optional): the container (file extension) of the video, e.g. "avi" or "mkv". 
+	"auto" (default) uses mkv for FFV1 and avi for the other codecs.
+
+  34. "png_encoding" (object, optional): how frames are encoded to PNG, all OpenCV defaults if left out. 
+	"compression" (0-9) is the zlib level: 0 stores frames uncompressed, 1 is the fastest compression, and 9 the 
+	smallest files at several times the encoding time of level 1. "strategy" ("default", "filtered", 
+	"huffman_only", "rle", or "fixed") is the zlib strategy; "rle" and "huffman_only" are much faster than 
+	"default" at a somewhat lower ratio. "filter" ("none", "sub", "up", "avg", "paeth", "fast", or "all") picks the 
+	row filters and needs OpenCV 4.11 or later. Run "VidCapPacer --benchmark-png [saved frames...]" to see how 
+	fast one core encodes with each level, strategy, and filter, and pick a setting whose speed per core times 
+	encoder_threads is above the target frame rate.
+
+  35. "frame_output" (string, optional): where frames are saved. "png_files" (default) saves one image file per 
+	frame. "archive" appends every frame, with its grab and retrieve time stamps, to a single archive 
+	{output_folder}/{series_name}.vcpa, split into segments .000, .001, and so on. This avoids the cost of creating 
+	tens of thousands of files. An index at the end of the archive gives any frame directly, and 
+	"VidCapPacer --extract-archive {archive} [folder]" writes the frames back as the usual image files.
+
+  36. "archive_encoding" (string, optional): the lossless codec of the frames in the archive. "png" (default) uses 
+	the png_encoding settings. "qoi" encodes several times faster than PNG at a similar ratio (BGR frames only; 
+	raw YUY2 frames are stored as PNG). "lz4" and "zstd" compress the differences between neighbouring pixels, 
+	"lz4" at memory speed and "zstd" to smaller files; they are available if VidCap Pacer is built with 
+	VIDCAP_WITH_LZ4 and VIDCAP_WITH_ZSTD. "temporal" stores a key frame every temporal_key_interval frames and, 
+	in between, only the differences from the previous frame, which suits static scenes; frames are encoded in 
+	frame order on one core. "raw" stores the pixels uncompressed. Run "VidCapPacer --verify-codecs" to check that 
+	every codec decodes bit-exactly and see its speed and ratio.
+
+  37. "archive_segment_mb" (positive integer, optional): the largest size of an archive segment in megabytes 
+	(default 2048).
+
+  38. "archive_zstd_level" (integer, optional): the zstd compression level (default 1). Levels above 3 are rarely 
+	fast enough for capture.
+
+  39. "temporal_key_interval" (positive integer, optional): a key frame every this many frames with the "temporal" 
+	archive encoding (default 60). Reading a frame decodes up to this many frames, and a damaged frame spoils the 
+	frames after it up to the next key frame.
+
+  40. "storage_writer" (object, optional): how saved frames (image files or archive segments) are written to storage. 
+	"backend" is "buffered" (default, stdio and imwrite) or "io_uring" (Linux): frames are copied into "queue_depth" 
+	aligned chunks of "chunk_kb" KB (defaults 8 and 1024), and each full chunk is submitted without waiting, so an 
+	encoder thread only blocks when every chunk is in flight. VidCap Pacer must be built with VIDCAP_WITH_LIBURING 
+	(and linked with liburing) for io_uring; otherwise the chunks are written synchronously. "direct" (boolean) opens 
+	the files with O_DIRECT, bypassing the page cache, so that writeback never competes with capture. 
+	"fsync_interval_mb" flushes to storage after every this many MB an encoder thread writes (default 0, never), 
+	which keeps the amount of dirty data, and the stall of flushing it, small.
+
+  41. "flush_threads" (non-negative integer, optional): the number of threads saving the frames once capture is over 
+	when the whole session fits in the I/O buffer (default 0, one per logical CPU). Each thread encodes and stores 
+	the next frame not taken yet, and archived frames are appended as soon as they are encoded, so the time from 
+	the end of capture to the frames being on disk shrinks with the number of cores. The "temporal" archive 
+	encoding stores frames in order on one thread.
+
+  42. "buffer_memory_mb" (positive number, optional): the memory of the I/O buffer in megabytes, which replaces 
+	io_buffer_length. The buffer holds as many frames of the size the device delivers as fit, and no more than the 
+	whole session. To size it, "VidCapPacer --plan {settings}" measures, without a camera, how fast this machine 
+	encodes frames of the configured size with the configured encoding and how fast it writes to output_folder. It 
+	reports the sustainable frame rate, the buffer depth the session needs, and whether to stream frames to disk 
+	while capturing or keep the whole session in memory.
+
+  43. "buffer_huge_pages" (boolean, optional): back the I/O buffer with 2 MB huge pages (default false). The buffer 
+	is always one block of memory that is faulted in, on several threads if it is large, before capture starts, so 
+	the first pass through the buffer takes no page faults. Huge pages also spare the TLB misses of a large buffer. 
+	They come from the reserved huge pages (vm.nr_hugepages on Linux; on Windows, the "Lock pages in memory" 
+	privilege is needed) and otherwise from transparent huge pages on Linux.
+
+  44. "spill_capacity_mb" (positive integer, optional): the size of the spill file of the "spill" policy in megabytes 
+	(default 4096). It holds as many frames as fit, on top of the I/O buffer. Frames that fit neither are dropped.
+
+  45. "spill_high_water" (number from 0 to 1, optional): the share of the I/O buffer in use above which frames are 
+	spilled (default 0.9). Once a frame is spilled, the next ones are spilled too until the I/O threads have saved 
+	every spilled frame, so frames are still saved in the order they were captured and none waits long. With the 
+	"temporal" archive encoding, spilled frames are saved once capture is over, because that encoding stores 
+	frames in order, and frames are spilled only while the buffer is above the mark.
+
+  46. "buffer_compression" (string, optional): "none" (default), or a fast lossless codec ("lz4", "qoi", or "zstd", 
+	as in archive_encoding) that keeps the whole session in memory compressed. The memory io_buffer_length (or 
+	buffer_memory_mb) gives the buffer then holds compressed frames, several times more than raw ones. Frames pass 
+	through a small buffer of raw frames, are compressed by the encoder_threads I/O threads while capturing, and 
+	are decompressed and saved once capture is over, with flush_threads threads. Nothing is written to disk during 
+	capture unless frames are spilled. Frames that do not fit once the memory is full are dropped.
 */
 
 
@@ -116,23 +312,125 @@ double precapFineMarginTime = 0.00005;
 
 bool videoExport = false;
 
-
-// Variables handling frame buffering and saving.
-int bufferEndIndex = 0;
-int bufferStartIndex = 0;
-int framesNotWritten = 0;
-int framesLeftToCapture = 0;
-std::mutex writeMutex;
+string frameSourceType = "camera";  // "camera" or "synthetic"
+SyntheticCameraSettings syntheticCameraSettings;
+int v4l2BufferCount = 32;
+string capturePixelFormat = "bgr";  // "bgr" or "yuy2"
+bool saveRawFrames = false;
+string colorConversion = "auto";
+string sleepMode = "absolute";  // "absolute" or "millisecond"
+bool adaptiveMargins = false;
+string marginCalibrationFile = "";
+ThreadTuningSettings threadTuning;
+string pacerClock = "auto";
+int encoderThreads = 1;
+string overloadPolicy = "drop";  // "drop", "spill", "fast_encoder", or "abort"
+string spillFile = "";
+int spillCapacityMB = 4096;
+double spillHighWater = 0.9;
+string videoExportMode = "after";  // "after" or "live"
+bool savePngFrames = true;
+string videoCodec = "mjpg";
+string videoContainer = "auto";
+VideoCodec outputVideoCodec;  // Resolved from videoCodec and videoContainer.
+PngEncodingSettings pngEncoding;
+vector<int> pngParams;  // imwrite parameters of pngEncoding.
+StorageWriterSettings storageWriter;
+int exportThreads = 0;  // 0: one less than the number of logical CPUs
+int flushThreads = 0;  // 0: the number of logical CPUs
+double bufferMemoryMB = 0;  // 0: the buffer length is ioBufferLength.
+string frameOutput = "png_files";  // "png_files" or "archive"
+string archiveEncoding = "png";  // "png", "qoi", "lz4", "zstd", "temporal", or "raw"
+FrameCodec archiveCodec = FrameCodec::Png;  // Parsed from archiveEncoding.
+int archiveZstdLevel = 1;
+int temporalKeyInterval = 60;
+int archiveSegmentMB = 2048;
+
+
+// Variables handling frame buffering and saving. The buffer itself is a lock-free FramePool, so
+//   framesLeftToCapture is the only other state the two threads share.
+std::atomic<int> framesLeftToCapture{ 0 };
 int timeBetweenFramesMSec;
-cv::Mat saveBuffer;
+cv::Mat saveBuffer;  // Conversion buffer of the I/O side when spilled frames are saved at the end.
+FrameArena frameArena;  // Memory of the buffer slots and saveBuffer.
+bool bufferHugePages = false;
+string bufferCompression = "none";  // "none" or a codec name.
+FrameCodec bufferCodec = FrameCodec::Raw;  // Parsed from bufferCompression.
+CompressedFrameStore compressedFrames;  // The session, if it is held compressed.
+bool compressedSession = false;
+const int compressionStagingFrames = 32;  // Raw frames waiting to be compressed, at most.
 int numFrames;
 
+// Zero-copy retrieval: buffer slots hold headers over device buffers lent by the frame source.
+//   The token of each slot identifies the device buffer, to be released once the frame is saved.
+bool zeroCopyRetrieval = false;
+
+// Raw retrieval: buffer slots hold YUY2 frames, converted (or not) on the I/O side.
+bool rawRetrieval = false;
+int capturedFrameHeight = 0;
+int capturedFrameWidth = 0;
+
+// What became of each frame. Each entry is written by the thread handling that frame (the frame grabbing
+//   thread, then possibly an I/O thread that got the frame through the pool) and read once all threads end.
+enum FrameStatus : unsigned char { FrameNotCaptured, FrameSaved, FrameSavedFast, FrameSpilled, FrameDropped };
+vector<unsigned char> frameStatus;
+
+// Overload handling: frames spilled by the frame grabbing thread, whether the I/O threads are encoding fast
+//   to catch up, and whether capture was aborted.
+SpillStore spillStore;
+int spillHighWaterSlots = 0;  // Slots in use from which frames are spilled.
+bool drainSpillWhileCapturing = true;  // False if spilled frames must wait until capture is over.
+std::atomic<bool> fastEncoding{ false };
+bool captureAborted = false;
+
+// Live video export: the frame pool passes every frame to the video in frame order, one at a time, so the
+//   video and its conversion buffer need no lock.
+LiveVideoSink liveVideo;
+Mat liveVideoBuffer;
+
+// Frame archive, open while frames are saved if frame_output is "archive". Encoder threads append to it.
+FrameArchiveWriter frameArchive;
+
+// Temporal archive encoding: each frame is coded against the one before, so frames are stored in frame order by
+//   the ordered sink of the frame pool (or by whoever saves the whole sequence), never by several threads at once.
+bool temporalArchive = false;
+TemporalEncoder temporalEncoder;
+Mat temporalBuffer;  // Conversion buffer of the ordered sink.
+
 
 int main(int argc, char* argv[]) {
 	if (argc == 1) {
 		cout << "Please provide the path to video capture settings." << endl;
 		return 0;
 	}
+	else if (string(argv[1]) == "--verify-color-conversion") {
+		return verifyColorConversionKernels() ? 0 : 1;
+	}
+	else if (string(argv[1]) == "--benchmark-clocks") {
+		benchmarkPacerClocks();
+		return 0;
+	}
+	else if (string(argv[1]) == "--benchmark-png") {
+		return benchmarkPngEncoding(vector<string>(argv + 2, argv + argc)) ? 0 : 1;
+	}
+	else if (string(argv[1]) == "--verify-codecs") {
+		return verifyFrameCodecs() ? 0 : 1;
+	}
+	else if (string(argv[1]) == "--extract-archive") {
+		if (argc < 3) {
+			cout << "Usage: VidCapPacer --extract-archive {archive} [output folder]" << endl;
+			return 1;
+		}
+		return extractArchive(argv[2], argc > 3 ? argv[3] : "") ? 0 : 1;
+	}
+	else if (string(argv[1]) == "--plan") {
+		if (argc < 3) {
+			cout << "Usage: VidCapPacer --plan {video capture settings}" << endl;
+			return 1;
+		}
+		readJsonVidCaptureSettings(argv[2]);
+		return planSession() ? 0 : 1;
+	}
 	else {
 		readJsonVidCaptureSettings(argv[1]);
 		if (seriesNameReportPrefix) {
@@ -143,7 +441,9 @@ int main(int argc, char* argv[]) {
 	}
     cout << "Initializing Video Capture\n";
 	cout << "Target frame rate = " << targetFPS << "\n";
-	shrptr_VideoCapture cap = initVideoCapture(camID, frameHeight, frameWidth, targetFPS);
+	shrptr_FrameSource cap = initVideoCapture(camID, frameHeight, frameWidth, targetFPS);
+	if (cap == nullptr)
+		return 0;
 	
 	numFrames = (int)(targetFPS * recordTimeSeconds);
 	cout << "Number of frames = " << numFrames << "\n";
@@ -199,9 +499,25 @@ void checkTargetFpsAgainstActualFps(const double targetFPS, const double actualF
 }
 
 
-shrptr_VideoCapture initVideoCapture(const int camID, const int frameHeight,
+/// <summary>
+/// Create the frame source selected by frame_source and apply the capture settings to it.
+/// </summary>
+/// <returns>Shared pointer to the frame source, or nullptr if the device cannot be opened.</returns>
+shrptr_FrameSource initVideoCapture(const int camID, const int frameHeight,
 		const int frameWidth, const double fps) {
-	shrptr_VideoCapture cap(new VideoCapture(camID));	// open the default camera
+	shrptr_FrameSource cap;
+	if (frameSourceType == "synthetic") {
+		cap = std::make_shared<SyntheticFrameSource>(syntheticCameraSettings);
+	}
+#ifdef __linux__
+	else if (frameSourceType == "v4l2") {
+		cap = std::make_shared<V4l2FrameSource>(camID, v4l2BufferCount);
+	}
+#endif
+	else {
+		cap = std::make_shared<OpenCvFrameSource>(camID);	// open the default camera
+	}
+	cout << "Frame source: " << cap->backendName() << "\n";
 	if (!cap->isOpened()) { // check if we succeeded
 		printf("Cannot open camera ID %d\n", camID);
 		printf("Please check your camera ID and make sure it is connected and turned on.\n");
@@ -231,23 +547,46 @@ shrptr_VideoCapture initVideoCapture(const int camID, const int frameHeight,
 /// <param name="idealTimeBetweenFrame">Ideal time between two consecutive frames. 
 ///   The frame ID and this ideal time are used to compute the ideal time for next frame grab.</param>
 /// <param name="time0">Reference time at the beginning of the first frame interval.</param>
-/// <returns></returns>
-int waitForNextGrab(int nextFrameID, double idealTimeBetweenFrames, double time0) {
-	double currTime = omp_get_wtime();
+/// <param name="sleeper">Absolute-deadline sleeper of the calling thread, or nullptr to sleep in whole
+///   milliseconds.</param>
+/// <param name="wakeLateness">Receives how much later than requested the thread woke up, NaN if it did
+///   not sleep.</param>
+/// <param name="wakeSlack">Receives the time left before the ideal time when the thread woke up,
+///   NaN if it did not sleep.</param>
+/// <returns>Sleeping time in milliseconds, -1 if the thread did not sleep.</returns>
+int waitForNextGrab(int nextFrameID, double idealTimeBetweenFrames, double time0, DeadlineSleeper* sleeper,
+		double& wakeLateness, double& wakeSlack) {
+	double currTime = pacerNow();
 	double elapsedTime = currTime - time0;
 	double nextTime = nextFrameID * idealTimeBetweenFrames;
   
 	// Put thread to sleep for precap rough margin time.
 	int waitTime = -1;
-	if (elapsedTime < nextTime - precapRoughMarginTime) {  // Need to wait until the next time
+	double requestedSleep = 0;
+	if (sleeper != nullptr) {  // Sleep to just before the ideal time. Only the measured wake-up latency is left.
+		requestedSleep = sleeper->sleepUntil(time0 + nextTime);
+		if (requestedSleep > 0)
+			waitTime = (int)(requestedSleep * 1000);
+	}
+	else if (elapsedTime < nextTime - precapRoughMarginTime) {  // Need to wait until the next time
 		waitTime = (int)((nextTime - elapsedTime - precapRoughMarginTime) * 1000);
 		if (waitTime > 0)
 			std::this_thread::sleep_for(std::chrono::milliseconds(waitTime));
+		requestedSleep = waitTime / 1000.0;
+	}
+	if (requestedSleep > 0) {
+		const double wakeTime = pacerNow() - time0;
+		wakeLateness = wakeTime - (elapsedTime + requestedSleep);
+		wakeSlack = nextTime - wakeTime;
+	}
+	else {
+		wakeLateness = std::numeric_limits<double>::quiet_NaN();
+		wakeSlack = std::numeric_limits<double>::quiet_NaN();
 	}
 	
 	// Use loop spinning to check time, continue when it is close to the ideal time for next frame grabbing.
 	double nextTimeAbsolute = nextTime + time0;
-	while (nextTimeAbsolute - omp_get_wtime() > precapFineMarginTime) {
+	while (nextTimeAbsolute - pacerNow() > precapFineMarginTime) {
 		continue;
 	}
 	return waitTime;
@@ -264,7 +603,15 @@ void readJsonVidCaptureSettings(string jsonSettingsPath) {
 	timeStampReportFileName = vcaptureSettings["time_stamp_report_file_name"];
 	timeDeviationReportFileName = vcaptureSettings["time_deviation_report_file_name"];
 	seriesNameReportPrefix = vcaptureSettings["series_name_report_prefix"];
-	ioBufferLength = vcaptureSettings["io_buffer_length"];
+	ioBufferLength = vcaptureSettings.value("io_buffer_length", ioBufferLength);
+	bufferMemoryMB = vcaptureSettings.value("buffer_memory_mb", bufferMemoryMB);
+	bufferHugePages = vcaptureSettings.value("buffer_huge_pages", bufferHugePages);
+	bufferCompression = vcaptureSettings.value("buffer_compression", bufferCompression);
+	if (bufferCompression != "none" && (!parseFrameCodec(bufferCompression, bufferCodec) ||
+			bufferCodec == FrameCodec::Temporal || bufferCodec == FrameCodec::Png)) {
+		fmt::print("Buffer compression \"{}\" is not available. Frames are buffered raw.\n", bufferCompression);
+		bufferCompression = "none";
+	}
 
 	camID = vcaptureSettings["camera_id"];
 	frameHeight = vcaptureSettings["frame_height"];
@@ -275,6 +622,67 @@ void readJsonVidCaptureSettings(string jsonSettingsPath) {
 	precapRoughMarginTime = vcaptureSettings["precap_rough_margin_time"];
 	precapFineMarginTime = vcaptureSettings["precap_fine_margin_time"];
 	videoExport = vcaptureSettings["video_export"];
+	videoExportMode = vcaptureSettings.value("video_export_mode", videoExportMode);
+	savePngFrames = vcaptureSettings.value("save_png_frames", savePngFrames);
+	videoCodec = vcaptureSettings.value("video_codec", videoCodec);
+	exportThreads = vcaptureSettings.value("export_threads", exportThreads);
+	videoContainer = vcaptureSettings.value("video_container", videoContainer);
+	outputVideoCodec = resolveVideoCodec(videoCodec, videoContainer);
+	if (vcaptureSettings.contains("png_encoding"))
+		readPngEncodingSettings(vcaptureSettings["png_encoding"], pngEncoding);
+	pngParams = pngWriteParams(pngEncoding);
+	if (vcaptureSettings.contains("storage_writer"))
+		readStorageWriterSettings(vcaptureSettings["storage_writer"], storageWriter);
+	frameOutput = vcaptureSettings.value("frame_output", frameOutput);
+	archiveEncoding = vcaptureSettings.value("archive_encoding", archiveEncoding);
+	if (!parseFrameCodec(archiveEncoding, archiveCodec)) {
+		fmt::print("Frame codec \"{}\" is not available in this build. PNG is used instead.\n", archiveEncoding);
+		archiveEncoding = "png";
+		archiveCodec = FrameCodec::Png;
+	}
+	archiveZstdLevel = vcaptureSettings.value("archive_zstd_level", archiveZstdLevel);
+	temporalKeyInterval = max(1, vcaptureSettings.value("temporal_key_interval", temporalKeyInterval));
+	temporalEncoder.setKeyInterval(temporalKeyInterval);
+	archiveSegmentMB = vcaptureSettings.value("archive_segment_mb", archiveSegmentMB);
+	if (exportThreads <= 0)
+		exportThreads = max(1, (int)std::thread::hardware_concurrency() - 1);
+	flushThreads = vcaptureSettings.value("flush_threads", flushThreads);
+	if (flushThreads <= 0)
+		flushThreads = max(1, (int)std::thread::hardware_concurrency());
+	if (!savePngFrames) {  // The video is the only output, and there are no images to read back.
+		videoExport = true;
+		videoExportMode = "live";
+	}
+
+	frameSourceType = vcaptureSettings.value("frame_source", frameSourceType);
+	if (vcaptureSettings.contains("synthetic_camera"))
+		readSyntheticCameraSettings(vcaptureSettings["synthetic_camera"], syntheticCameraSettings);
+	v4l2BufferCount = vcaptureSettings.value("v4l2_buffer_count", v4l2BufferCount);
+	capturePixelFormat = vcaptureSettings.value("capture_pixel_format", capturePixelFormat);
+	saveRawFrames = vcaptureSettings.value("save_raw_frames", saveRawFrames);
+	colorConversion = vcaptureSettings.value("color_conversion", colorConversion);
+	sleepMode = vcaptureSettings.value("sleep_mode", sleepMode);
+	adaptiveMargins = vcaptureSettings.value("adaptive_margins", adaptiveMargins);
+	marginCalibrationFile = vcaptureSettings.value("margin_calibration_file", marginCalibrationFile);
+	if (!marginCalibrationFile.empty() &&
+			MarginCalibrator::readLearnedMargins(marginCalibrationFile, precapRoughMarginTime, precapFineMarginTime))
+		cout << "Precap margins are read from " << marginCalibrationFile << "\n";
+	encoderThreads = std::max(1, vcaptureSettings.value("encoder_threads", encoderThreads));
+	overloadPolicy = vcaptureSettings.value("overload_policy", overloadPolicy);
+	spillFile = vcaptureSettings.value("spill_file", spillFile);
+	spillCapacityMB = vcaptureSettings.value("spill_capacity_mb", spillCapacityMB);
+	spillHighWater = vcaptureSettings.value("spill_high_water", spillHighWater);
+	pacerClock = vcaptureSettings.value("pacer_clock", pacerClock);
+	if (!setPacerClock(pacerClock)) {
+		cout << "Clock \"" << pacerClock << "\" is not available here. Using the default one.\n";
+		setPacerClock("auto");
+	}
+	if (vcaptureSettings.contains("thread_tuning"))
+		readThreadTuningSettings(vcaptureSettings["thread_tuning"], threadTuning);
+	if (!setColorConversionKernel(colorConversion)) {
+		cout << "Color conversion kernel \"" << colorConversion << "\" is not supported here. Using the fastest one.\n";
+		setColorConversionKernel("auto");
+	}
 }
 
 
@@ -289,38 +697,113 @@ void printCaptureSettings() {
 	fmt::print("Time Stamp Report File Name: {}\n", timeStampReportFileName);
 	fmt::print("Time Deviation Report File Name: {}\n", timeDeviationReportFileName);
 	fmt::print("Use Series Name as Prefix to Report File Name: {}\n", seriesNameReportPrefix);
-	fmt::print("I/O Buffer Length: {} frames\n\n", ioBufferLength);
-
+	if (bufferMemoryMB > 0)
+		fmt::print("I/O Buffer Memory: {} MB\n", bufferMemoryMB);
+	else
+		fmt::print("I/O Buffer Length: {} frames\n", ioBufferLength);
+	fmt::print("I/O Buffer Pages: {}\n", bufferHugePages ? "huge" : "normal");
+	fmt::print("I/O Buffer Compression: {}\n", bufferCompression);
+	fmt::print("Encoder Threads: {}\n", encoderThreads);
+	fmt::print("Flush Threads: {}\n", flushThreads);
+	fmt::print("Overload Policy: {}", overloadPolicy);
+	if (overloadPolicy == "spill")
+		fmt::print(" ({} MB spill file, high-water mark {:.0f}%)", spillCapacityMB, spillHighWater * 100);
+	fmt::print("\n\n");
+
+	fmt::print("Frame Source: {}\n", frameSourceType);
 	fmt::print("Camera ID: {}\n", camID);
 	fmt::print("Frame Height: {} pixels\n", frameHeight);
 	fmt::print("Frame Width: {} pixels\n", frameWidth);
+	fmt::print("Capture Pixel Format: {}\n", capturePixelFormat);
 	fmt::print("Target Frames Per Seconds (FPS): {} fps\n", targetFPS);
 	fmt::print("Recording time: {} seconds\n\n", recordTimeSeconds);
 
 	fmt::print("Rough Margin Time before Frame Grabbing: {:.5f} seconds\n", precapRoughMarginTime);
 	fmt::print("Fine Margin Time before Frame Grabbing: {:.5f} seconds\n", precapFineMarginTime);
-	fmt::print("Export to Video: {}\n", videoExport);
+	fmt::print("Clock: {}\n", pacerClockName());
+	fmt::print("Sleep Mode: {}\n", sleepMode);
+	fmt::print("Adaptive Margins: {}\n", adaptiveMargins);
+	fmt::print("Thread Tuning: {}\n", threadTuning.summary());
+	fmt::print("Save Raw Frames: {}\n", saveRawFrames);
+	fmt::print("Color Conversion Kernel: {}\n", colorConversionKernelName());
+	fmt::print("Save PNG Frames: {}", savePngFrames);
+	if (savePngFrames)
+		fmt::print(" ({})", pngEncoding.summary());
+	fmt::print("\n");
+	if (savePngFrames)
+		fmt::print("Storage Writer: {}\n", storageWriter.summary());
+	if (savePngFrames && frameOutput == "archive")
+		fmt::print("Frame Output: archive ({}{}, {} MB segments)\n", archiveEncoding,
+			archiveCodec == FrameCodec::Temporal ? fmt::format(", a key frame every {} frames", temporalKeyInterval) : "",
+			archiveSegmentMB);
+	fmt::print("Export to Video: {}", videoExport);
+	if (videoExport)
+		fmt::print(" ({}, {} {} in {}{})", videoExportMode, outputVideoCodec.lossless ? "lossless" : "lossy",
+			outputVideoCodec.name, outputVideoCodec.container,
+			videoExportMode == "after" ? fmt::format(", {} reading threads",
+				frameOutput == "archive" && archiveCodec == FrameCodec::Temporal ? 1 : exportThreads) : "");
+	fmt::print("\n");
 	fmt::print("===== ===== ===== ===== ===== =====\n\n");
 }
 
 
-void prepareBufferFrames(std::vector<cv::Mat>& frames, const int height,
-		const int width) {
-	saveBuffer = cv::Mat(height, width, CV_8UC3);
-	for (int frameID = 0; frameID < ioBufferLength; ++frameID) {
-		frames.at(frameID) = cv::Mat(height, width, CV_8UC3);
+/// <summary>
+/// Allocate buffer slots shaped like the frames the device delivers (BGR, or raw YUY2 whose shape depends on
+///   the backend), so that retrieval never reallocates a slot. The slots and saveBuffer are carved out of the
+///   frame arena, which is faulted in here, before capture starts.
+/// </summary>
+void prepareBufferFrames(FramePool& pool, const int rows,
+		const int cols, const int type) {
+	const size_t saveBytes = (size_t)capturedFrameHeight * capturedFrameWidth * 3;
+	const size_t slotBytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+	// Slots will point to device buffers when borrowing. Nothing to allocate for them then.
+	const int ownSlots = zeroCopyRetrieval ? 0 : pool.capacity();
+	const size_t arenaBytes = FrameArena::pieceSize(saveBytes) + ownSlots * FrameArena::pieceSize(slotBytes);
+	if (!frameArena.reserve(arenaBytes, bufferHugePages)) {
+		fmt::print("Cannot reserve {:.1f} MB for the frame buffer in one block. Frames are allocated one by one.\n",
+			arenaBytes / (1024.0 * 1024));
+		saveBuffer = cv::Mat(capturedFrameHeight, capturedFrameWidth, CV_8UC3);
+		for (int slotID = 0; slotID < ownSlots; ++slotID)
+			pool.slot(slotID).frame = cv::Mat(rows, cols, type);
+		return;
 	}
+	const double t0 = pacerNow();
+	const int threads = frameArena.prefault();
+	fmt::print("Frame buffer: {:.1f} MB on {}, faulted in on {} thread(s) in {:.0f} ms\n",
+		frameArena.size() / (1024.0 * 1024), frameArena.pageKind(), threads, (pacerNow() - t0) * 1000);
+	// Headers over the arena. They do not own the memory, which the arena keeps until the program ends.
+	saveBuffer = cv::Mat(capturedFrameHeight, capturedFrameWidth, CV_8UC3, frameArena.carve(saveBytes));
+	for (int slotID = 0; slotID < ownSlots; ++slotID)
+		pool.slot(slotID).frame = cv::Mat(rows, cols, type, frameArena.carve(slotBytes));
+}
+
+
+/// <summary>
+/// Create the spill file of the "spill" policy at its full size, before capture starts. Spilled frames are saved
+///   while capturing unless the archive encoding needs frames in order.
+/// </summary>
+void openSpillStore(const int rows, const int cols, const int type) {
+	const string path = spillFile.empty() ? outputFolder + "/" + seriesName + "_spill.bin" : spillFile;
+	spillHighWaterSlots = max(1, min(ioBufferLength, (int)ceil(spillHighWater * ioBufferLength)));
+	drainSpillWhileCapturing = !(savePngFrames && frameOutput == "archive" && archiveCodec == FrameCodec::Temporal);
+	const double t0 = pacerNow();
+	if (!spillStore.open(path, rows, cols, type, (size_t)spillCapacityMB << 20)) {
+		fmt::print("Cannot create the spill file {}. Frames that do not fit in the buffer will be dropped.\n", path);
+		return;
+	}
+	fmt::print("Spill file: {} frames after {} in the buffer, created in {:.0f} ms\n", spillStore.capacity(),
+		spillHighWaterSlots, (pacerNow() - t0) * 1000);
 }
 
 
 /// Retrieve a frame and store it in a frame array. Then, compute an elapsed time
 ///   based on the reference time0.
 /// <returns>Elapsed time from the beginning of processing (time0).</return>
-double pushFrameToMat(shrptr_VideoCapture cap, double time0, vector<Mat>& frames, 
+double pushFrameToMat(shrptr_FrameSource cap, double time0, vector<Mat>& frames, 
 		int frameID) {
 	cap->retrieve(frames.at(frameID));
 
-	double currTime = omp_get_wtime();
+	double currTime = pacerNow();
 	double elapsedTime = currTime - time0;	// record how much time passed (milli-second)
 	int elapsedSecond = (int)elapsedTime;	// record how much time passed (second, drop fractional value).
 	return elapsedTime;
@@ -328,69 +811,355 @@ double pushFrameToMat(shrptr_VideoCapture cap, double time0, vector<Mat>& frames
 
 
 /// <summary>
-/// Save a frame in the buffer to storage and handle buffer indices. 
+/// Frames in the buffer are normally BGR, but raw frames and frames lent by a frame source stay in the
+///   native YUY2 format of the device. Convert such frames to BGR so that they can be saved, unless the
+///   user wants raw frames saved.
+/// </summary>
+/// <param name="frame">A frame from the buffer.</param>
+/// <param name="converted">Storage for the converted frame, reused between calls.</param>
+/// <returns>The frame itself if it is BGR already, otherwise the converted (or reshaped) frame.</returns>
+const Mat& frameForWriting(const Mat& frame, Mat& converted) {
+	if (frame.type() == CV_8UC3)
+		return frame;
+
+	// Some backends deliver a raw frame as a single row of bytes.
+	Mat yuy2 = frame.type() == CV_8UC2 ? frame : frame.reshape(2, capturedFrameHeight);
+	if (saveRawFrames) {
+		converted = yuy2;
+		return converted;
+	}
+	convertYuy2ToBgr(yuy2, converted);
+	return converted;
+}
+
+
+/// <summary>
+/// Like frameForWriting, but always BGR, because a video cannot hold raw frames.
+/// </summary>
+const Mat& frameAsBgr(const Mat& frame, Mat& converted) {
+	if (frame.type() == CV_8UC3)
+		return frame;
+	convertYuy2ToBgr(frame.type() == CV_8UC2 ? frame : frame.reshape(2, capturedFrameHeight), converted);
+	return converted;
+}
+
+
+/// <summary>
+/// Codec of a frame of this type (as frameForWriting gives it) in the archive: the archive encoding, or PNG if the
+///   encoding cannot take the frame.
+/// </summary>
+FrameCodec archiveCodecFor(const int type) {
+	return frameCodecSupports(archiveCodec, type) ? archiveCodec : FrameCodec::Png;
+}
+
+
+/// <summary>
+/// Save a frame as an image file, or append it to the frame archive if one is open.
+/// </summary>
+/// <param name="frameID">ID of the frame.</param>
+/// <param name="frame">The frame, in the buffer format.</param>
+/// <param name="converted">Storage for a converted frame, reused between calls.</param>
+/// <param name="params">PNG encoding parameters.</param>
+/// <param name="grabTime">Grab time stamp of the frame, stored in the archive.</param>
+/// <param name="retrieveTime">Retrieve time stamp of the frame, stored in the archive.</param>
+void storeFrame(const int frameID, const Mat& frame, Mat& converted, const vector<int>& params,
+		const double grabTime, const double retrieveTime) {
+	const Mat& image = frameForWriting(frame, converted);
+	if (!frameArchive.isOpen()) {
+		const string path = fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID);
+		if (storageWriter.backend == "buffered") {
+			imwrite(path, frameAsImage(image), params);
+			return;
+		}
+		thread_local StorageWriter imageWriter(storageWriter);  // Its chunks are reused from one file to the next.
+		thread_local vector<uchar> png;
+		cv::imencode(".png", frameAsImage(image), png, params);
+		if (imageWriter.open(path))
+			imageWriter.write(png.data(), png.size());
+		imageWriter.close();
+		return;
+	}
+	ArchiveFrameInfo info;
+	info.frameID = frameID;
+	info.rows = image.rows;
+	info.cols = image.cols;
+	info.type = image.type();
+	info.grabTime = grabTime;
+	info.retrieveTime = retrieveTime;
+	// Frames a codec cannot take as they are (raw YUY2 frames for QOI and PNG) are stored as 1-channel PNG images.
+	info.encoding = archiveCodecFor(image.type());
+	if (info.encoding == FrameCodec::Raw && image.isContinuous()) {  // Nothing to encode, so no copy either.
+		frameArchive.append(info, image.data, image.total() * image.elemSize());
+		return;
+	}
+	thread_local vector<uchar> encoded;  // One per encoder thread, so that its capacity is reused.
+	if (info.encoding == FrameCodec::Temporal)
+		temporalEncoder.encode(frameID, image, encoded);
+	else
+		encodeFrame(info.encoding, image, encoded, params, archiveZstdLevel);
+	frameArchive.append(info, encoded.data(), encoded.size());
+}
+
+
+/// <summary>
+/// Save a frame in the buffer to storage. The slot stays in the Encoding state until the caller
+///   releases it to the pool, so the frame cannot be overwritten while it is being encoded.
 /// This is one of the core functions of an I/O thread.
 /// </summary>
-/// <param name="frameID">ID of a frame to be saved.</param>
-/// <param name="frames">Pointer to a frame buffer.</param>
-void writeFrameToImageFile(int frameID, vector<Mat>* frames) {
-	string imgPath = fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID);
+/// <param name="slot">The buffer slot holding the frame to be saved.</param>
+/// <param name="converted">Conversion buffer of the calling I/O thread.</param>
+/// <param name="fast">If true, a PNG is stored without compression, which is several times faster.</param>
+void writeFrameToImageFile(FramePool::Slot& slot, Mat& converted, bool fast) {
+	static const vector<int> fastPngParams = { cv::IMWRITE_PNG_COMPRESSION, 0 };
+	if (!savePngFrames || temporalArchive)  // Temporal frames are stored in frame order by finishFrameInOrder().
+		return;
+	// Only PNG has a faster setting. A frame stored with another codec is saved as usual, and if the I/O threads
+	//   still fall behind, the frame grabbing thread drops frames.
+	const int storedType = slot.frame.type() == CV_8UC3 || !saveRawFrames ? CV_8UC3 : CV_8UC2;
+	fast = fast && (!frameArchive.isOpen() || archiveCodecFor(storedType) == FrameCodec::Png);
+	storeFrame(slot.frameID, slot.frame, converted, fast ? fastPngParams : pngParams, slot.grabTime, slot.retrieveTime);
+	if (fast)
+		frameStatus[slot.frameID] = FrameSavedFast;
+}
+
 
-	writeMutex.lock(); {
-		saveBuffer = frames->at(bufferStartIndex);
-		bufferStartIndex = (bufferStartIndex + 1) % ioBufferLength;
-		framesNotWritten -= 1;
+/// <summary>
+/// Keep a frame of a session held compressed in memory. It is saved once capture is over.
+/// </summary>
+/// <param name="slot">The buffer slot holding the frame.</param>
+void compressFrame(FramePool::Slot& slot) {
+	static std::atomic<bool> fullReported{ false };
+	if (compressedFrames.add(slot.frameID, slot.frame, slot.grabTime, slot.retrieveTime))
+		return;
+	frameStatus[slot.frameID] = FrameDropped;
+	if (!fullReported.exchange(true))
+		fmt::print("The compressed buffer is full at frame {}. Later frames that do not fit are dropped.\n",
+			slot.frameID);
+}
+
+
+/// <summary>
+/// Finish with a frame once every frame before it is finished too. The frame pool calls this in frame order,
+///   one slot at a time, just before the slot is given back to the frame grabbing thread. The frame is stored
+///   if the archive is temporal, it goes into the live video, and then a buffer lent by the frame source is
+///   returned.
+/// </summary>
+/// <param name="slot">The buffer slot whose frame is saved.</param>
+/// <param name="cap">Shared pointer to the capturing device, which gets lent buffers back.</param>
+void finishFrameInOrder(FramePool::Slot& slot, shrptr_FrameSource cap) {
+	if (temporalArchive && !compressedSession)
+		storeFrame(slot.frameID, slot.frame, temporalBuffer, pngParams, slot.grabTime, slot.retrieveTime);
+	if (liveVideo.isOpened())
+		liveVideo.write(slot.frameID, frameAsBgr(slot.frame, liveVideoBuffer));
+	if (zeroCopyRetrieval)
+		cap->releaseBorrowed(slot.token);
+}
+
+
+/// <summary>
+/// Deal with a frame that does not fit in the buffer, according to overload_policy. The frame has been
+///   grabbed but not retrieved. Dropping it costs nothing; a device simply reuses its buffer on the next grab.
+/// This runs on the frame grabbing thread and never waits for the I/O threads.
+/// </summary>
+/// <param name="cap">Shared pointer to the capturing device.</param>
+/// <param name="time0">Reference time at the beginning of the first frame interval.</param>
+/// <param name="grabTimeStamp">Grab time of the frame from time0.</param>
+/// <param name="frameID">ID of the frame that does not fit.</param>
+void handleBufferOverload(shrptr_FrameSource cap, double time0, double grabTimeStamp, int frameID) {
+	static Mat spillFrame;
+	static bool overloadReported = false;
+	static bool misfitReported = false;
+	if (!overloadReported) {
+		fmt::print("I/O buffer is {} at frame {}. Overload policy: {}\n",
+			overloadPolicy == "spill" ? "past its high-water mark" : "full", frameID, overloadPolicy);
+		overloadReported = true;
 	}
-	writeMutex.unlock();
 
-	imwrite(imgPath, saveBuffer);
+	if (overloadPolicy == "abort") {
+		captureAborted = true;
+		return;
+	}
+	if (overloadPolicy == "spill") {
+		// Retrieve straight into the spill file, or copy a lent frame there.
+		Mat* record = spillStore.acquireForFilling();
+		if (record != nullptr) {
+			bool retrieved;
+			if (zeroCopyRetrieval) {
+				int token = -1;
+				retrieved = cap->retrieveBorrowed(spillFrame, token);
+				if (retrieved) {
+					spillFrame.copyTo(*record);
+					cap->releaseBorrowed(token);
+				}
+			}
+			else {
+				retrieved = cap->retrieve(*record);
+			}
+			if (!retrieved) {
+				spillStore.cancel();
+			}
+			else if (spillStore.publish(frameID, grabTimeStamp, pacerNow() - time0)) {
+				frameStatus[frameID] = FrameSpilled;
+				return;
+			}
+			else if (!misfitReported) {  // The record is given back, and the frame is dropped.
+				fmt::print("Frame {} does not fit the records of the spill file. Such frames are dropped.\n", frameID);
+				misfitReported = true;
+			}
+		}
+	}
+	frameStatus[frameID] = FrameDropped;  // Also the last resort of "spill" and "fast_encoder".
 }
 
 
 /// <summary>
-/// Retrieve a frame from a capturing device, place it to the buffer, and handle buffer indices.
+/// Retrieve a frame from a capturing device and place it to the buffer.
 /// This is one of the core functions of a frame grabbing thread. Note that the frame is grabbed
 ///   earlier. This function retrieves the grabbed data from the device to the buffer.
+///   It never waits for the I/O thread.
 /// </summary>
 /// <param name="cap">Shared pointer to the capturing device.</param>
 /// <param name="time0">Reference time at the beginning of the first frame interval.</param>
-/// <param name="frames">Pointer to a frame buffer.</param>
+/// <param name="grabTimeStamp">Grab time of the frame from time0, kept with the frame in its slot.</param>
+/// <param name="pool">Reference to the frame buffer.</param>
 /// <param name="frameID">ID of a frame to be retrieved.</param>
 /// <returns>Elapsed time from the beginning of processing (time0).</returns>
-double pushFrameToMatCircularBuffer(shrptr_VideoCapture cap, double time0,
-		vector<Mat>& frames, int frameID) {
-	writeMutex.lock(); {
-		if ((bufferEndIndex + 1) % ioBufferLength == bufferStartIndex) {
-			printf("Error: I/O buffer is full.\n");
-			exit(0);
+double pushFrameToMatCircularBuffer(shrptr_FrameSource cap, double time0, double grabTimeStamp,
+		FramePool& pool, int frameID) {
+	// Past the high-water mark, and until every spilled frame is saved, frames go to the spill file.
+	const bool spilling = spillStore.isOpen() && (pool.slotsInUse() >= spillHighWaterSlots ||
+		(drainSpillWhileCapturing && spillStore.framesInUse() > 0));
+	FramePool::Slot* slot = spilling ? nullptr : pool.acquireForFilling();
+	if (slot == nullptr) {
+		handleBufferOverload(cap, time0, grabTimeStamp, frameID);
+	}
+	else {
+		// A frame the device failed to deliver (a timed-out grab) is dropped, and the slot is given back as it
+		//   was. Its token is cleared so that no buffer is returned twice.
+		bool retrieved;
+		if (zeroCopyRetrieval)
+			retrieved = cap->retrieveBorrowed(slot->frame, slot->token);
+		else
+			retrieved = cap->retrieve(slot->frame);
+		if (!retrieved) {
+			slot->token = -1;
+			pool.cancel(*slot);
+			frameStatus[frameID] = FrameDropped;
+		}
+		else {
+			slot->frameID = frameID;
+			slot->grabTime = grabTimeStamp;
+			slot->retrieveTime = pacerNow() - time0;
+			frameStatus[frameID] = FrameSaved;
+			pool.publish(*slot);
 		}
-		bufferEndIndex = (bufferEndIndex + 1) % ioBufferLength;
-		cap->retrieve(frames.at(bufferEndIndex));
-		framesNotWritten += 1;
-		framesLeftToCapture -= 1;
 	}
-	writeMutex.unlock();
+	if (captureAborted)  // No more frames will come. Let the I/O threads finish what is buffered.
+		framesLeftToCapture.store(0, std::memory_order_release);
+	else
+		framesLeftToCapture.fetch_sub(1, std::memory_order_release);
 
-	double currTime = omp_get_wtime();
+	double currTime = pacerNow();
 	double elapsedTime = currTime - time0;	// record how much time passed (milli-second)
 	int elapsedSecond = (int)elapsedTime;	// record how much time passed (second, drop fractional value).
 	return elapsedTime;
 }
 
 
-void saveFramesThd(vector<Mat>* frames) {
-	int frameID = 0;
-	while (framesLeftToCapture > 0 || framesNotWritten > 0) {
-		if (framesNotWritten == 0) {  // Wait for a grabber to get another frame.
+/// <summary>
+/// The loop of an I/O (encoder) thread. Several of them can run at once: each claims the oldest frame not yet
+///   claimed, saves it, and releases its slot. The pool frees the slots in frame order. Spilled frames are newer
+///   than every frame in the pool, so they are claimed only when the pool has none waiting.
+/// </summary>
+/// <param name="pool">Pointer to the frame buffer.</param>
+/// <param name="encoderIndex">Index of this encoder thread.</param>
+void saveFramesThd(FramePool* pool, int encoderIndex) {
+	tuneIoThread(threadTuning, encoderIndex);
+	Mat converted(capturedFrameHeight, capturedFrameWidth, CV_8UC3);
+	while (true) {
+		FramePool::Slot* slot = pool->claimForEncoding();
+		if (slot == nullptr) {
+			SpillStore::Record* record = drainSpillWhileCapturing ? spillStore.claim() : nullptr;
+			if (record != nullptr) {
+				if (savePngFrames)
+					storeFrame(record->frameID, record->frame, converted, pngParams, record->grabTime,
+						record->retrieveTime);
+				spillStore.release(*record);
+				continue;
+			}
+			// Once the grabber has published its last frame, no pending frame means we are done.
+			if (framesLeftToCapture.load(std::memory_order_acquire) == 0 && pool->pendingFrames() == 0 &&
+					(!drainSpillWhileCapturing || spillStore.pendingFrames() == 0))
+				break;
+			// Wait for a grabber to get another frame.
 			std::this_thread::sleep_for(std::chrono::milliseconds(timeBetweenFramesMSec));
 			continue;
 		}
-		writeFrameToImageFile(frameID, frames);
-		frameID += 1;
+		// With the fast_encoder policy, encode fast while at least three quarters of the buffer are waiting
+		//   (this frame included), and go back to normal once no more than a quarter is.
+		if (overloadPolicy == "fast_encoder") {
+			const int waiting = pool->pendingFrames() + 1;
+			if (waiting * 4 >= pool->capacity() * 3)
+				fastEncoding.store(true, std::memory_order_relaxed);
+			else if (waiting * 4 <= pool->capacity())
+				fastEncoding.store(false, std::memory_order_relaxed);
+		}
+		if (compressedSession)
+			compressFrame(*slot);
+		else
+			writeFrameToImageFile(*slot, converted, fastEncoding.load(std::memory_order_relaxed));
+		pool->release(*slot);
+	}
+}
+
+
+/// Name of a frame status in the reports. Frames that are not saved mark gaps in the image sequence.
+const char* frameStatusName(unsigned char status) {
+	switch (status) {
+	case FrameSaved: return "saved";
+	case FrameSavedFast: return "saved_fast";
+	case FrameSpilled: return "spilled";
+	case FrameDropped: return "dropped";
+	default: return "not_captured";
 	}
 }
 
 
+/// <summary>
+/// Save the frames the "spill" policy put aside and the I/O threads have not saved, now that capture is over,
+///   and delete the spill file.
+/// </summary>
+void saveSpilledFrames() {
+	if (spillStore.pendingFrames() == 0) {
+		spillStore.close();
+		return;
+	}
+	fmt::print("\nSaving {} spilled frames.\n", spillStore.pendingFrames());
+	spillStore.drain([](const SpillStore::Record& record) {
+		if (!savePngFrames)
+			return;
+		storeFrame(record.frameID, record.frame, saveBuffer, pngParams, record.grabTime, record.retrieveTime);
+	});
+	cout << "Saving spilled frames DONE\n";
+}
+
+
+/// <summary>
+/// Count the frames in each status and print the counts, unless every frame was saved normally.
+/// </summary>
+/// <returns>A one-line summary for the reports, empty if every frame was saved normally.</returns>
+string frameStatusSummary() {
+	int counts[FrameDropped + 1] = {};
+	for (unsigned char status : frameStatus)
+		counts[status] += 1;
+	if (counts[FrameSaved] == (int)frameStatus.size())
+		return "";
+	return fmt::format("Frames saved = {}, saved fast = {}, spilled and saved = {}, dropped = {}, not captured = {}",
+		counts[FrameSaved], counts[FrameSavedFast], counts[FrameSpilled], counts[FrameDropped],
+		counts[FrameNotCaptured]);
+}
+
+
 /// <summary>
 /// Report the time stamp of each frame to a file.
 /// </summary>
@@ -401,9 +1170,10 @@ void reportTimeStamps(vector<double>& grabTimeStamps, vector<double>& retrieveTi
 	cout << "\nSaving the time stamp of each frame to " << timeStampPath << "\n";
 	ofstream reportFile(timeStampPath);
 
-	reportFile << "FrameID\tGrabTime(s)\tRetrievalTime(s)\n";
+	reportFile << "FrameID\tGrabTime(s)\tRetrievalTime(s)\tStatus\n";
 	for (int i = 0; i < grabTimeStamps.size(); ++i) {
-		reportFile << fmt::format("{}\t{}\t{}\n", i + 1, grabTimeStamps.at(i), retrieveTimeStamps.at(i));
+		reportFile << fmt::format("{}\t{}\t{}\t{}\n", i + 1, grabTimeStamps.at(i), retrieveTimeStamps.at(i),
+			frameStatusName(frameStatus.at(i)));
 		if (i % 100 == 0)  // Print a dot for each 100 lines saved
 			printf(".");
 	}
@@ -412,6 +1182,93 @@ void reportTimeStamps(vector<double>& grabTimeStamps, vector<double>& retrieveTi
 }
 
 
+/// <summary>
+/// Write every frame of a frame archive as an image file named like the ones saved without an archive, so that
+///   tools expecting an image sequence can read it. PNG frames are written as they are stored.
+/// </summary>
+/// <param name="archivePath">The archive, with or without the segment number, e.g. out/demo.vcpa.</param>
+/// <param name="folder">Folder of the image files. Empty means the folder of the archive.</param>
+/// <returns>False if the archive cannot be read.</returns>
+bool extractArchive(string archivePath, string folder) {
+	if (archivePath.size() > 4 && archivePath.compare(archivePath.size() - 4, 4, ".000") == 0)
+		archivePath.resize(archivePath.size() - 4);
+	FrameArchiveReader archive;
+	if (!archive.open(archivePath)) {
+		fmt::print("Cannot open the frame archive {}\n", archivePath);
+		return false;
+	}
+	if (archive.recovered())
+		fmt::print("The archive has no index (it was not closed). Its frames were found by scanning it.\n");
+
+	// The series name is the file name of the archive without ".vcpa".
+	const size_t slash = archivePath.find_last_of("/\\");
+	const string fileName = slash == string::npos ? archivePath : archivePath.substr(slash + 1);
+	seriesName = fileName.substr(0, fileName.rfind(".vcpa"));
+	outputFolder = !folder.empty() ? folder : slash == string::npos ? "." : archivePath.substr(0, slash);
+	setImgFileNameFormatString(archive.frameCount());
+
+	int extracted = 0;
+	vector<uchar> payload;
+	Mat frame;
+	for (int frameID = 0; frameID < archive.frameCount(); ++frameID) {
+		const ArchiveFrameInfo& info = archive.info(frameID);
+		if (info.segment < 0)
+			continue;
+		const string imgPath = fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID);
+		if (info.encoding == FrameCodec::Png && archive.readPayload(frameID, payload)) {
+			ofstream(imgPath, ios::binary).write((const char*)payload.data(), payload.size());
+			extracted += 1;
+		}
+		else if (archive.readFrame(frameID, frame) && imwrite(imgPath, frameAsImage(frame))) {
+			extracted += 1;
+		}
+		if (frameID % 100 == 0)  // Print a dot for each 100 images saved.
+			printf(".");
+	}
+	fmt::print("\nExtracted {} of {} frames to {}\n", extracted, archive.frameCount(), outputFolder);
+	return true;
+}
+
+
+/// <summary>
+/// Plan the session the settings describe, with frames in the buffer as a session would have them.
+/// </summary>
+/// <returns>False if the plan cannot be made.</returns>
+bool planSession() {
+	if (!savePngFrames) {
+		cout << "With save_png_frames false, only the live video is written, which the planner does not measure.\n";
+		return false;
+	}
+	CapacityPlanSettings plan;
+	plan.frameSize = cv::Size(frameWidth, frameHeight);
+	plan.bufferType = capturePixelFormat == "yuy2" ? CV_8UC2 : CV_8UC3;
+	plan.targetFps = targetFPS;
+	plan.recordTimeSeconds = recordTimeSeconds;
+	plan.encoderThreads = encoderThreads;
+	plan.flushThreads = flushThreads > 0 ? flushThreads : max(1, (int)std::thread::hardware_concurrency());
+	const double frameBytes = (double)plan.frameSize.area() * CV_ELEM_SIZE(plan.bufferType);
+	plan.bufferLength = bufferMemoryMB > 0 ? bufferLengthForMemory(bufferMemoryMB, frameBytes) : ioBufferLength;
+	const bool toArchive = frameOutput == "archive";
+	plan.orderedEncoding = toArchive && archiveCodec == FrameCodec::Temporal;
+	plan.encodingName = toArchive ? fmt::format("archive, {}", archiveEncoding) :
+		fmt::format("image files, {}", pngEncoding.summary());
+	capturedFrameHeight = frameHeight;
+	capturedFrameWidth = frameWidth;
+	plan.encode = [toArchive](const Mat& frame, int frameID, vector<uchar>& encoded) {  // As storeFrame does.
+		thread_local Mat converted;
+		const Mat& image = frameForWriting(frame, converted);
+		const FrameCodec codec = toArchive ? archiveCodecFor(image.type()) : FrameCodec::Png;
+		if (codec == FrameCodec::Temporal)
+			temporalEncoder.encode(frameID, image, encoded);
+		else
+			encodeFrame(codec, image, encoded, pngParams, archiveZstdLevel);
+	};
+	plan.scratchPath = outputFolder + "/" + seriesName + "_plan.tmp";
+	plan.storage = storageWriter;
+	return planCapacity(plan);
+}
+
+
 /// <summary>
 /// We want to make frame IDs with running numbers in format 00123 where leading zeros
 ///   are not too many for the number of frame we aim at. Therefore, this function takes
@@ -428,15 +1285,65 @@ void setImgFileNameFormatString(const int numFrames) {
 }
 
 
-void exportAllImages(vector<Mat>& frames) {
-	printf("\nSaving all %d images.\n", numFrames);	
-	for (int i = 0; i < numFrames; ++i) {
-		string img_path = fmt::format(imgFileFormatStr, outputFolder, seriesName, i);
-		imwrite(img_path, frames.at(i));
-		if (i % 100 == 0)  // Print a dot for each 100 images saved.
-			printf(".");
+/// <summary>
+/// Save every frame once capture is over and the whole sequence is in the pool (frame i in slot i), or in the
+///   compressed frame store. Saving threads take the next frame not taken yet, so all cores encode at once,
+///   while this thread feeds the live video in frame order. The slots are only read, so nothing else needs a lock.
+/// </summary>
+void exportAllImages(FramePool& pool) {
+	const int savingThreads = !savePngFrames ? 0 : temporalArchive ? 1 : min(flushThreads, max(1, numFrames));
+	fmt::print("\nSaving all {} images with {} thread(s).\n", numFrames, savingThreads);
+	const double t0 = pacerNow();
+	std::atomic<int> nextFrame{ 0 };
+	std::atomic<int> framesSaved{ 0 };
+	auto saveFrames = [&pool, &nextFrame, &framesSaved]() {
+		Mat converted;  // Conversion buffer of this thread.
+		Mat decompressed;
+		for (int i = nextFrame++; i < numFrames; i = nextFrame++) {
+			if (!compressedSession) {
+				const FramePool::Slot& slot = pool.slot(i);
+				storeFrame(i, slot.frame, converted, pngParams, slot.grabTime, slot.retrieveTime);
+			}
+			else if (compressedFrames.get(i, decompressed)) {
+				storeFrame(i, decompressed, converted, pngParams, compressedFrames.grabTime(i),
+					compressedFrames.retrieveTime(i));
+			}
+			else {  // Not captured, or it did not fit in the store.
+				if (frameStatus[i] != FrameNotCaptured)
+					frameStatus[i] = FrameDropped;
+				continue;
+			}
+			if (++framesSaved % 100 == 0)  // Print a dot for each 100 images saved.
+				printf(".");
+		}
+	};
+	vector<std::thread> threads;
+	for (int t = 0; t < savingThreads; ++t)
+		threads.emplace_back(saveFrames);
+	if (liveVideo.isOpened() && !compressedSession) {  // A compressed session has fed it while capturing.
+		for (int i = 0; i < numFrames; ++i)
+			liveVideo.write(i, frameAsBgr(pool.slot(i).frame, liveVideoBuffer));
+	}
+	for (std::thread& t : threads)
+		t.join();
+	fmt::print("\nSaving all images DONE, {:.2f} seconds\n", pacerNow() - t0);
+}
+
+
+/// <summary>
+/// Open the live video before capture starts. If the codec is not available, fall back to exporting the
+///   video after capture, or to no video if no image file is saved.
+/// </summary>
+void openLiveVideo(const int framesPerSec) {
+	const string videoPath = outputFolder + "/" + seriesName;
+	liveVideoBuffer = cv::Mat(capturedFrameHeight, capturedFrameWidth, CV_8UC3);
+	if (liveVideo.open(videoPath, outputVideoCodec, framesPerSec,
+			cv::Size(capturedFrameWidth, capturedFrameHeight))) {
+		fmt::print("Encoding the video live to {}.{}\n", videoPath, outputVideoCodec.container);
+		return;
 	}
-	cout << "\nSaving all images DONE\n";
+	fmt::print("Cannot open {}.{} with codec {}. {}\n", videoPath, outputVideoCodec.container, outputVideoCodec.name,
+		savePngFrames ? "The video will be exported after capture." : "No video will be exported.");
 }
 
 
@@ -444,25 +1351,56 @@ void exportAllImages(vector<Mat>& frames) {
 ///  Export a saved image sequence to a video. The method loads images from storage and
 ///    put them together as a video.
 /// </summary>
-/// <param name="frames">Reference to the frame buffer vector.</param>
 /// <param name="numFrames">The number of frames in the recording sequence.</param>
 /// <param name="framesPerSec">Frame rate (frames per second, fps).</param>
-void exportVideo(vector<Mat>& frames, const int numFrames, const int framesPerSec) {
-	cout << "\nExporting a video from a saved image sequence." << endl;
-	double t0 = omp_get_wtime();
+void exportVideo(const int numFrames, const int framesPerSec) {
+	cout << "\nExporting a video from saved frames." << endl;
+	double t0 = pacerNow();
 	printf("Frame size (width, height) = (%d, %d)\n", frameWidth, frameHeight);
-	string videoPath = outputFolder + "/" + seriesName + ".avi";
-	VideoWriter vidWriter(videoPath,
-		cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
-		framesPerSec, cv::Size(frameWidth, frameHeight), true);
-
-	Mat vidFrame = cv::Mat(frameHeight, frameWidth, CV_8UC3);
-	for (int frameID = 0; frameID < numFrames; ++frameID) {
-		vidWriter << cv::imread(fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID));
-		if (frameID % 100 == 0)  // Print a dot for each 100 images saved.
-			printf(".");
+	const string videoPath = outputFolder + "/" + seriesName;
+	VideoWriter vidWriter;
+	if (!openVideoWriter(vidWriter, videoPath, outputVideoCodec, framesPerSec, cv::Size(frameWidth, frameHeight))) {
+		fmt::print("Cannot open {}.{} with codec {}. No video is exported.\n", videoPath, outputVideoCodec.container,
+			outputVideoCodec.name);
+		return;
 	}
-	fmt::print("\nExporting a video DONE, {:.2f} seconds\n", omp_get_wtime() - t0);
+
+	// Reading threads decode the image files (and convert raw frames) ahead of this thread, which only encodes.
+	//   Two frames in flight per reading thread keep every thread busy without holding many frames in memory.
+	FrameArchiveReader archive;
+	const bool fromArchive = frameOutput == "archive" && archive.open(outputFolder + "/" + seriesName + ".vcpa");
+	auto readFrame = [&archive, fromArchive](int frameID, Mat& frame) {
+		const unsigned char status = frameStatus.at(frameID);
+		if (status == FrameDropped || status == FrameNotCaptured)
+			return false;
+		Mat image;
+		if (fromArchive)
+			archive.readFrame(frameID, image);
+		else if (saveRawFrames)  // Raw frames are saved as 1-channel images holding the YUY2 bytes.
+			image = imageAsFrame(cv::imread(fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID),
+				cv::IMREAD_UNCHANGED), CV_8UC2);
+		else
+			image = cv::imread(fmt::format(imgFileFormatStr, outputFolder, seriesName, frameID), cv::IMREAD_COLOR);
+		if (image.empty())
+			return false;
+		if (image.type() == CV_8UC2)
+			convertYuy2ToBgr(image, frame);
+		else
+			frame = image;
+		return true;
+	};
+	Mat vidFrame = cv::Mat(frameHeight, frameWidth, CV_8UC3, cv::Scalar::all(0));
+	// Temporal frames decode one after another from the frame decoded last, so one reader is as fast as any.
+	const int readers = fromArchive && archiveCodec == FrameCodec::Temporal ? 1 : exportThreads;
+	prefetchInOrder(numFrames, readers, 2 * readers + 2, readFrame,
+		[&vidWriter, &vidFrame](int frameID, bool hasFrame, Mat& frame) {
+			if (hasFrame)  // Otherwise repeat the previous frame over a gap, so the video keeps its timing.
+				cv::swap(vidFrame, frame);
+			vidWriter << vidFrame;
+			if (frameID % 100 == 0)  // Print a dot for each 100 images saved.
+				printf(".");
+		});
+	fmt::print("\nExporting a video DONE, {:.2f} seconds\n", pacerNow() - t0);
 }
 
 
@@ -472,9 +1410,9 @@ void exportVideo(vector<Mat>& frames, const int numFrames, const int framesPerSe
 ///   Therefore, we will drop a few frames, say 5, and start the process from the sixth.
 /// </summary>
 /// <param name="cap">Shared pointer to the capturing device.</param>
-/// <param name="dummyFrame">A dummy frame for data retrieval. 
-///   You may use the first frame in the buffer for this.</param>
-void warmUpGrabbingAndRetrieving(shrptr_VideoCapture cap, Mat dummyFrame) {
+/// <param name="dummyFrame">A dummy frame for data retrieval. After warming up, it holds a frame
+///   in the format the device delivers.</param>
+void warmUpGrabbingAndRetrieving(shrptr_FrameSource cap, Mat& dummyFrame) {
 	for (int i = 0; i < 5; ++i) {
 		cap->grab();
 		cap->retrieve(dummyFrame);  // This dummy frame will be overwriten by a real frame.
@@ -496,9 +1434,11 @@ void reportGrabTimeAndDeviation(const int numFrames, const double idealTimeBetwe
 	ofstream reportFile(reportPath);
 	reportFile << "FrameID\t" << "FrameTime(ms)\t" << "WaitTime(ms)\t" << "ArrivalTimeDeviation(ms)\n";
 
+	// If capture was aborted, only the frames grabbed before that are reported.
+	const int grabbedFrames = std::min(numFrames, (int)grabTimeStamps.size());
 	double previousTimeStamp = 0;
 	double timeDiffSum = 0;
-	for (int frameID = 0; frameID < numFrames; ++frameID) {
+	for (int frameID = 0; frameID < grabbedFrames; ++frameID) {
 		double grabTime = grabTimeStamps.at(frameID);
 		double frameStartTime = idealTimeBetweenFrames * frameID;
 		double expectedTime = (idealTimeBetweenFrames * (frameID + 1));
@@ -511,11 +1451,16 @@ void reportGrabTimeAndDeviation(const int numFrames, const double idealTimeBetwe
 			cout << ".";
 	}
 	reportFile << fmt::format("\nTotal absolute deviation time = {:.2f} ms, average absolute deviation time = {:.3f} ms\n",
-		timeDiffSum, timeDiffSum / numFrames);
+		timeDiffSum, timeDiffSum / std::max(1, grabbedFrames));
+	const string statusSummary = frameStatusSummary();
+	if (!statusSummary.empty())
+		reportFile << statusSummary << "\n";
 	reportFile.close();
 	cout << "\nSaving time deviation DONE" << endl;
 	fmt::print("\nTotal absolute deviation time = {:.2f} ms, average absolute deviation time = {:.3f} ms\n",
-		timeDiffSum, timeDiffSum / numFrames);
+		timeDiffSum, timeDiffSum / std::max(1, grabbedFrames));
+	if (!statusSummary.empty())
+		fmt::print("{}\n", statusSummary);
 }
 
 
@@ -524,30 +1469,54 @@ void reportGrabTimeAndDeviation(const int numFrames, const double idealTimeBetwe
 ///   the buffer, and waiting for an ideal frame grabbing time.
 /// </summary>
 /// <param name="cap">Shared pointer to the capturing device.</param>
-/// <param name="frames"></param>
+/// <param name="pool">Pointer to the frame buffer.</param>
 /// <param name="numFrames">The number of frames in the recording sequence.</param>
 /// <param name="idealTimeBetweenFrames">Ideal time between two consecutive frames.</param>
 /// <param name="grabTimeStamps">Pointer to a vector storing frame grabbing time stamps.</param>
 /// <param name="retrieveTimeStamps">Pointer to a vector storing frame retrieval time stamps.</param>
 /// <param name="waitTimes">Pointer to a vector storing wait time for each frame.</param>
-void grabPushWaitThdLoop(shrptr_VideoCapture cap, vector<Mat>* frames, 
+void grabPushWaitThdLoop(shrptr_FrameSource cap, FramePool* pool, 
 		const int numFrames, const double idealTimeBetweenFrames, 
 		vector<double>* grabTimeStamps, vector<double>* retrieveTimeStamps, 
 		vector<int>* waitTimes) {
-	double time0 = omp_get_wtime();
+	tuneGrabThread(threadTuning);
+	DeadlineSleeper sleeper(precapRoughMarginTime);
+	DeadlineSleeper* grabSleeper = sleepMode == "millisecond" ? nullptr : &sleeper;
+	MarginCalibrator calibrator(precapRoughMarginTime, precapFineMarginTime);
+	double wakeLateness, wakeSlack;
+	double time0 = pacerNow();
 	for (int frameID = 0; frameID < numFrames; ++frameID) {
 		// Video frame is captured when grab is called. So, we compute the wait time
 		//   right before we call grab.	For example, at 30 fps, the first frame should be captured
 		//   at about t = 0.0333 second.
-		int waitTime = waitForNextGrab(frameID + 1, idealTimeBetweenFrames, time0);
-		const double grabTimeStamp = omp_get_wtime() - time0;
+		int waitTime = waitForNextGrab(frameID + 1, idealTimeBetweenFrames, time0, grabSleeper,
+			wakeLateness, wakeSlack);
+		const double grabTimeStamp = pacerNow() - time0;
+		if (adaptiveMargins) {  // Margins for the next frame. Only this thread reads them during capture.
+			calibrator.observe(wakeLateness, wakeSlack, grabTimeStamp - (frameID + 1) * idealTimeBetweenFrames);
+			precapRoughMarginTime = calibrator.roughMargin();
+			precapFineMarginTime = calibrator.fineMargin();
+			sleeper.setMaxMargin(precapRoughMarginTime);
+		}
 		cap->grab();  // Video frame is stored in a buffer, waiting for retrieval to RAM.
 		grabTimeStamps->push_back(grabTimeStamp);
 		waitTimes->push_back(waitTime);
-		double t = pushFrameToMatCircularBuffer(cap, time0, *frames, frameID);
+		double t = pushFrameToMatCircularBuffer(cap, time0, grabTimeStamp, *pool, frameID);
 		retrieveTimeStamps->push_back(t);
+		if (captureAborted) {
+			fmt::print("Frame grabbing is aborted at frame {}.\n", frameID);
+			break;
+		}
+	}
+	fmt::print("Frame grapping DONE, {:.2f} seconds\n", pacerNow() - time0);
+	if (grabSleeper != nullptr)
+		fmt::print("Wake-up latency: {}\n", grabSleeper->latencySummary());
+	if (adaptiveMargins) {
+		fmt::print("Learned margins: rough {:.5f} seconds, fine {:.5f} seconds\n",
+			precapRoughMarginTime, precapFineMarginTime);
+		if (!marginCalibrationFile.empty())
+			calibrator.writeLearnedMargins(marginCalibrationFile);
 	}
-	fmt::print("Frame grapping DONE, {:.2f} seconds\n", omp_get_wtime() - time0);
 }
 
 
@@ -558,40 +1527,140 @@ void grabPushWaitThdLoop(shrptr_VideoCapture cap, vector<Mat>* frames,
 /// <param name="idealTimeBetweenFrames">Ideal time between two consecutive frames.</param>
 /// <param name="numFrames">The number of frames in the recording sequence.</param>
 /// <param name="framesPerSec">Frame rate (frames per second, fps)</param>
-void captureToMemorySpace(shrptr_VideoCapture cap, const double idealTimeBetweenFrames,
+void captureToMemorySpace(shrptr_FrameSource cap, const double idealTimeBetweenFrames,
 	const int numFrames, const int framesPerSec) {
-	vector<Mat> frames(ioBufferLength);  // Use parameter numFrames if all to be stored.
 	const int frameHeight = (int)cap->get(cv::CAP_PROP_FRAME_HEIGHT);
 	const int frameWidth = (int)cap->get(cv::CAP_PROP_FRAME_WIDTH);
-	prepareBufferFrames(frames, frameHeight, frameWidth);
-	warmUpGrabbingAndRetrieving(cap, frames.at(0));
+	capturedFrameHeight = frameHeight;
+	capturedFrameWidth = frameWidth;
+
+	// Ask for raw frames if needed, and check what the device actually delivers while warming up.
+	Mat warmUpFrame;
+	rawRetrieval = capturePixelFormat == "yuy2" && cap->setRawRetrieval(true);
+	warmUpGrabbingAndRetrieving(cap, warmUpFrame);
+	if (rawRetrieval && warmUpFrame.total() * warmUpFrame.elemSize() != (size_t)frameHeight * frameWidth * 2) {
+		cap->setRawRetrieval(false);
+		rawRetrieval = false;
+		warmUpGrabbingAndRetrieving(cap, warmUpFrame);
+	}
+	if (capturePixelFormat == "yuy2" && !rawRetrieval)
+		cout << "The device cannot deliver raw YUY2 frames. Frames will be converted to BGR while grabbing.\n";
+
+	// The frame size is known now, so a memory budget can be turned into a buffer length.
+	const double frameBytes = (double)warmUpFrame.total() * warmUpFrame.elemSize();
+	compressedSession = bufferCompression != "none" && savePngFrames;
+	if (compressedSession) {
+		// The memory of the buffer holds the compressed session, behind a small buffer of raw frames.
+		const size_t storeBytes = bufferMemoryMB > 0 ? (size_t)(bufferMemoryMB * 1024 * 1024) :
+			(size_t)(frameBytes * ioBufferLength);
+		const double t0 = pacerNow();
+		if (compressedFrames.reserve(storeBytes, numFrames, bufferCodec, bufferHugePages)) {
+			ioBufferLength = min(numFrames, compressionStagingFrames);
+			fmt::print("Compressed buffer: {:.1f} MB ({:.0f} raw frames) with {}, ready in {:.0f} ms\n",
+				storeBytes / (1024.0 * 1024), storeBytes / frameBytes, bufferCompression, (pacerNow() - t0) * 1000);
+		}
+		else {
+			fmt::print("Cannot reserve {:.1f} MB for the compressed buffer. Frames are buffered uncompressed.\n",
+				storeBytes / (1024.0 * 1024));
+			compressedSession = false;
+		}
+	}
+	if (!compressedSession && bufferMemoryMB > 0) {
+		ioBufferLength = min(numFrames, bufferLengthForMemory(bufferMemoryMB, frameBytes));
+		fmt::print("I/O buffer length: {} frames{}\n", ioBufferLength,
+			ioBufferLength == numFrames ? " (the whole session)" : "");
+	}
+	FramePool pool(ioBufferLength);  // numFrames if all to be stored.
+
+	// Borrow device buffers only when the I/O thread keeps up with capture. When the whole sequence
+	//   is buffered, no device has that many buffers to lend.
+	// A session held compressed goes through the I/O threads like one that does not fit in the buffer.
+	const bool savedAfterCapture = numFrames <= ioBufferLength || compressedSession;
+	zeroCopyRetrieval = numFrames > ioBufferLength && cap->maxBorrowedFrames() >= ioBufferLength;
+	if (zeroCopyRetrieval)
+		cout << "Zero-copy frame handoff to the I/O thread is enabled.\n";
+	prepareBufferFrames(pool, warmUpFrame.rows, warmUpFrame.cols, warmUpFrame.type());
+	fmt::print("I/O buffer memory: {:.1f} MB ({} bytes per frame)\n",
+		zeroCopyRetrieval ? 0.0 : frameBytes * ioBufferLength / (1024 * 1024), frameBytes);
 	
+	// Reserve the report vectors, so that the frame grabbing thread does not reallocate (and fault in) them.
 	vector<double> grabTimeStamps;
 	vector<double> retrieveTimeStamps;
 	vector<int> waitTimes;
+	grabTimeStamps.reserve(numFrames);
+	retrieveTimeStamps.reserve(numFrames);
+	waitTimes.reserve(numFrames);
+	frameStatus.assign(numFrames, FrameNotCaptured);
+	if (threadTuning.lockMemory && lockProcessMemory())
+		cout << "Frame buffers are locked in memory.\n";
+	// Map the spill file only once memory is locked, so that locking does not pin the tier beyond RAM in RAM.
+	if (overloadPolicy == "spill" && numFrames > ioBufferLength) {
+		// Spilled frames are copies of what the frame grabbing thread retrieves, which is a frame lent by the
+		//   device in its native format when borrowing. Borrow one to see its shape.
+		Mat retrieved = warmUpFrame;
+		int token = -1;
+		if (zeroCopyRetrieval && cap->grab() && cap->retrieveBorrowed(retrieved, token))
+			cap->releaseBorrowed(token);
+		openSpillStore(retrieved.rows, retrieved.cols, retrieved.type());
+	}
 	
+	if (videoExport && videoExportMode == "live")
+		openLiveVideo(framesPerSec);
+	if (savePngFrames && frameOutput == "archive") {
+		const string archivePath = outputFolder + "/" + seriesName + ".vcpa";
+		if (!frameArchive.open(archivePath, (uint64_t)archiveSegmentMB << 20, storageWriter))
+			fmt::print("Cannot create the frame archive {}. Frames will be saved as image files.\n", archivePath);
+		temporalArchive = frameArchive.isOpen() && archiveCodec == FrameCodec::Temporal;
+	}
+
 	// Start a frame grabbing thread 
-	std::thread grabThread(grabPushWaitThdLoop, cap, &frames, numFrames, 
+	std::thread grabThread(grabPushWaitThdLoop, cap, &pool, numFrames, 
 		idealTimeBetweenFrames, &grabTimeStamps, &retrieveTimeStamps, &waitTimes);
 
-	// Start a thread for saving video frames if I/O buffer cannot contain the entire expected sequence.
-	if (numFrames > ioBufferLength) {
-		std::thread frameSavingThread(saveFramesThd, &frames);
-		frameSavingThread.join();
+	// Start threads for saving video frames if I/O buffer cannot contain the entire expected sequence, or
+	//   for compressing them.
+	if (numFrames > ioBufferLength || compressedSession) {
+		pool.setOrderedSink([cap](FramePool::Slot& slot) { finishFrameInOrder(slot, cap); });
+		vector<std::thread> frameSavingThreads;
+		for (int i = 0; i < encoderThreads; ++i)
+			frameSavingThreads.emplace_back(saveFramesThd, &pool, i);
+		for (std::thread& t : frameSavingThreads)
+			t.join();
 	}	
 
 	grabThread.join();
+	saveSpilledFrames();
 
 	reportTimeStamps(grabTimeStamps, retrieveTimeStamps);
 
 	// If the buffer can hold the entire set of grabbed frames, we will write the frames
 	//   when all frames are available in the buffer. The I/O thread is not created in this case.
-	if (numFrames <= ioBufferLength) {
-		exportAllImages(frames);
+	if (savedAfterCapture) {
+		if (compressedSession)
+			fmt::print("Compressed buffer: {} frames in {:.1f} MB, ratio {:.2f}\n", compressedFrames.framesStored(),
+				compressedFrames.size() / (1024.0 * 1024), compressedFrames.framesStored() * frameBytes /
+				max((size_t)1, compressedFrames.size()));
+		exportAllImages(pool);
+	}
+	if (frameArchive.isOpen()) {
+		const int archivedFrames = frameArchive.framesWritten();
+		const int segments = frameArchive.segmentCount();
+		const bool closed = frameArchive.close(numFrames);
+		fmt::print("Frame archive: {} frames, {:.1f} MB in {} segment(s){}\n", archivedFrames,
+			frameArchive.bytesWritten() / (1024.0 * 1024), segments, closed ? "" : ", writing the index FAILED");
+		if (temporalArchive)
+			fmt::print("Temporal encoding: {} key frames, {} delta frames\n", temporalEncoder.keyFrames(),
+				temporalEncoder.deltaFrames());
 	}
 
-	if(videoExport)
-		exportVideo(frames, numFrames, framesPerSec);
+	if (liveVideo.isOpened()) {
+		liveVideo.close(numFrames);
+		fmt::print("Live video: {} frames, {} of them repeated over gaps\n",
+			liveVideo.framesWritten(), liveVideo.repeatedFrames());
+	}
+	else if (videoExport && savePngFrames) {
+		exportVideo(numFrames, framesPerSec);
+	}
 
 	reportGrabTimeAndDeviation(numFrames, idealTimeBetweenFrames, grabTimeStamps, waitTimes);
 }
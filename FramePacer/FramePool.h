@@ -0,0 +1,142 @@
+/**
+  Preallocated frame pool of VidCap Pacer. Every slot has an explicit owner state, so the frame grabbing thread
+    and the I/O side hand frames to each other without a mutex and without copying them.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+
+/// <summary>
+/// A fixed set of preallocated frame slots filled by exactly one producer (the frame grabbing thread) and
+///   emptied by one or more encoders (the I/O threads).
+/// Each slot goes through Free -> Filling -> Ready -> Encoding -> Encoded -> Free:
+///   - acquireForFilling() gives the producer the next slot in sequence if it is Free, and marks it Filling.
+///   - publish() marks it Ready with a release store, which makes the frame visible to the encoders.
+///   - claimForEncoding() gives the oldest Ready slot to an encoder and marks it Encoding.
+///   - release() marks it Encoded, only after the encoder is completely done with the frame (and has given
+///     a borrowed device buffer back). Until then the producer cannot touch the slot, so a frame can never be
+///     overwritten while it is being encoded, and no frame needs to be deep-copied to protect it.
+///   - Encoded slots are then freed strictly in frame order, whatever order the encoders finish in. The ordered
+///     sink, if any, sees each frame right before its slot is freed, which is where consumers that need frames
+///     in order (e.g. a video writer) hook in.
+/// Slots are visited round-robin, so frame k of a sequence that fits in the pool is in slot k.
+/// </summary>
+class FramePool {
+public:
+	enum class SlotState : int { Free, Filling, Ready, Encoding, Encoded };
+
+	// Slots are cache-line aligned so that the state flips of neighbouring slots, which belong to different
+	//   threads, do not invalidate each other's lines.
+	struct alignas(64) Slot {
+		cv::Mat frame;
+		int frameID = -1;
+		int token = -1;  // Token of a frame borrowed from the frame source, -1 if the frame is ours.
+		double grabTime = 0;      // Time stamps of the frame, in seconds from the start of capture.
+		double retrieveTime = 0;
+		std::atomic<SlotState> state{ SlotState::Free };
+	};
+
+	explicit FramePool(const int capacity) : slots(capacity) {}
+
+	int capacity() const { return (int)slots.size(); }
+
+	/// <summary>
+	/// Set the function called with each encoded slot, in frame order, before the slot is freed. It runs on one
+	///   encoder at a time. Set it before any encoder starts.
+	/// </summary>
+	void setOrderedSink(std::function<void(Slot&)> sink) { orderedSink = std::move(sink); }
+	Slot& slot(const int index) { return slots[index]; }
+
+	/// Number of frames published and not yet claimed by an encoder.
+	int pendingFrames() const {
+		return (int)(published.load(std::memory_order_acquire) - claimed.load(std::memory_order_acquire));
+	}
+
+	/// Producer: the number of slots holding a frame that is not freed yet.
+	int slotsInUse() const { return (int)(nextToFill - nextToFree.load(std::memory_order_acquire)); }
+
+	/// Producer: the next slot in sequence, or nullptr if it is still in use (the pool is full).
+	Slot* acquireForFilling() {
+		Slot& s = slots[nextToFill % slots.size()];
+		if (s.state.load(std::memory_order_acquire) != SlotState::Free)
+			return nullptr;
+		s.state.store(SlotState::Filling, std::memory_order_relaxed);
+		return &s;
+	}
+
+	/// Producer: hand the slot returned by acquireForFilling() to the encoders.
+	void publish(Slot& s) {
+		s.state.store(SlotState::Ready, std::memory_order_release);
+		nextToFill += 1;
+		published.store(nextToFill, std::memory_order_release);
+	}
+
+	/// Producer: give back the slot returned by acquireForFilling() without a frame. It is acquired again next.
+	void cancel(Slot& s) { s.state.store(SlotState::Free, std::memory_order_relaxed); }
+
+	/// Encoder: the oldest Ready slot, or nullptr if no frame is waiting. Safe to call from several encoders.
+	Slot* claimForEncoding() {
+		size_t c = claimed.load(std::memory_order_relaxed);
+		while (true) {
+			Slot& s = slots[c % slots.size()];
+			// A Ready slot at the claim cursor always holds frame c: frame c + capacity cannot be filled
+			//   before this slot has been encoded and released.
+			if (s.state.load(std::memory_order_acquire) != SlotState::Ready)
+				return nullptr;
+			if (claimed.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+				s.state.store(SlotState::Encoding, std::memory_order_relaxed);
+				return &s;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Encoder: mark a slot as fully encoded, then free every encoded slot that is next in frame order.
+	/// The encoder that finishes the oldest frame frees the run of frames behind it that other encoders have
+	///   already finished. An encoder that finds another one freeing leaves the work to it, and the freeing
+	///   encoder checks again after it stops, so no finished slot is left behind. The producer never takes
+	///   part. The Encoded store, the freeing flag, nextToFree, and the check are all sequentially consistent,
+	///   so of two racing encoders at least one sees the other's slot.
+	/// </summary>
+	void release(Slot& s) {
+		s.state.store(SlotState::Encoded, std::memory_order_seq_cst);
+		while (nextToFreeIsEncoded() && !freeing.exchange(true, std::memory_order_seq_cst)) {
+			size_t f = nextToFree.load();
+			// Slot f can only be Encoded for frame f itself: frame f + capacity cannot be filled before
+			//   slot f is freed.
+			while (slots[f % slots.size()].state.load(std::memory_order_acquire) == SlotState::Encoded) {
+				if (orderedSink)
+					orderedSink(slots[f % slots.size()]);
+				slots[f % slots.size()].state.store(SlotState::Free, std::memory_order_release);
+				f += 1;
+			}
+			nextToFree.store(f);
+			freeing.store(false, std::memory_order_seq_cst);
+		}
+	}
+
+private:
+	std::vector<Slot> slots;
+	std::function<void(Slot&)> orderedSink;
+
+	size_t nextToFill = 0;  // Producer only.
+	alignas(64) std::atomic<size_t> published{ 0 };
+	alignas(64) std::atomic<size_t> claimed{ 0 };
+
+	// Encoders only. nextToFree is written only by the encoder holding the freeing flag.
+	alignas(64) std::atomic<bool> freeing{ false };
+	std::atomic<size_t> nextToFree{ 0 };
+
+	bool nextToFreeIsEncoded() const {
+		return slots[nextToFree.load() % slots.size()].state.load() == SlotState::Encoded;
+	}
+};
@@ -0,0 +1,224 @@
+/**
+  Frame source implementations of VidCap Pacer: the OpenCV camera and the synthetic camera.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "FrameSource.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+using json = nlohmann::json;
+
+
+OpenCvFrameSource::OpenCvFrameSource(const int camID) : cap(camID) {
+}
+
+
+double LatencyDistribution::sample(std::mt19937_64& rng) const {
+	double value = mean;
+	if (type == "uniform") {
+		std::uniform_real_distribution<double> dist(mean - spread, mean + spread);
+		value = dist(rng);
+	}
+	else if (type == "normal") {
+		std::normal_distribution<double> dist(mean, spread);
+		value = dist(rng);
+	}
+	else if (type == "lognormal") {
+		if (mean > 0) {
+			std::lognormal_distribution<double> dist(std::log(mean), spread);
+			value = dist(rng);
+		}
+	}
+	return std::max(0.0, value);
+}
+
+
+LatencyDistribution LatencyDistribution::fromJson(const json& j, const LatencyDistribution& defaults) {
+	LatencyDistribution dist = defaults;
+	dist.type = j.value("type", defaults.type);
+	dist.mean = j.value("mean", defaults.mean);
+	dist.spread = j.value("spread", defaults.spread);
+	return dist;
+}
+
+
+/// <summary>
+/// Read the "synthetic_camera" object of the JSON settings. Every key is optional and falls back to the
+///   value already in settings.
+/// </summary>
+void readSyntheticCameraSettings(const json& j, SyntheticCameraSettings& settings) {
+	settings.sensorFramePerSec = j.value("sensor_frame_per_sec", settings.sensorFramePerSec);
+	if (j.contains("grab_latency"))
+		settings.grabLatency = LatencyDistribution::fromJson(j["grab_latency"], settings.grabLatency);
+	if (j.contains("retrieve_latency"))
+		settings.retrieveLatency = LatencyDistribution::fromJson(j["retrieve_latency"], settings.retrieveLatency);
+	settings.stallProbability = j.value("stall_probability", settings.stallProbability);
+	settings.stallEveryNFrames = j.value("stall_every_n_frames", settings.stallEveryNFrames);
+	settings.stallDuration = j.value("stall_duration", settings.stallDuration);
+	settings.seed = j.value("seed", settings.seed);
+}
+
+
+void sleepUntilSteadyTime(std::chrono::steady_clock::time_point deadline) {
+	const auto spinTime = std::chrono::microseconds(300);
+	auto now = std::chrono::steady_clock::now();
+	if (deadline - now > spinTime)
+		std::this_thread::sleep_until(deadline - spinTime);
+	while (std::chrono::steady_clock::now() < deadline) {
+		continue;
+	}
+}
+
+
+SyntheticFrameSource::SyntheticFrameSource(const SyntheticCameraSettings& settings) :
+		settings(settings), rng(settings.seed) {
+	sensorTime0 = SteadyClock::now();
+}
+
+
+double SyntheticFrameSource::sensorPeriod() const {
+	const double fps = settings.sensorFramePerSec > 0 ? settings.sensorFramePerSec : requestedFramePerSec;
+	return 1.0 / fps;
+}
+
+
+bool SyntheticFrameSource::grab() {
+	const double period = sensorPeriod();
+	const double elapsed = std::chrono::duration<double>(SteadyClock::now() - sensorTime0).count();
+
+	// The newest frame the sensor has finished. If we already latched it, wait for the next one.
+	long long frameIndex = (long long)std::floor(elapsed / period);
+	if (frameIndex <= latchedFrameIndex)
+		frameIndex = latchedFrameIndex + 1;
+	const auto frameReadyTime = sensorTime0 +
+		std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(frameIndex * period));
+
+	grabCount += 1;
+	double delay = settings.grabLatency.sample(rng);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	bool stall = unit(rng) < settings.stallProbability;
+	if (settings.stallEveryNFrames > 0 && grabCount % settings.stallEveryNFrames == 0)
+		stall = true;
+	if (stall)
+		delay += settings.stallDuration;
+
+	auto deadline = std::max(frameReadyTime, SteadyClock::now()) +
+		std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(delay));
+	sleepUntilSteadyTime(deadline);
+
+	latchedFrameIndex = frameIndex;
+	return true;
+}
+
+
+bool SyntheticFrameSource::retrieve(cv::Mat& frame) {
+	if (latchedFrameIndex < 0)
+		return false;
+	const auto start = SteadyClock::now();
+	renderFrame(latchedFrameIndex, frame);
+	const double delay = settings.retrieveLatency.sample(rng);
+	sleepUntilSteadyTime(start +
+		std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(delay)));
+	return true;
+}
+
+
+/// <summary>
+/// Build the static gradient scene. In raw retrieval, the scene is converted to YUY2 with BT.601 studio-range
+///   coefficients, averaging chroma over each pixel pair.
+/// </summary>
+void SyntheticFrameSource::prepareBackground() {
+	cv::Mat bgr(frameHeight, frameWidth, CV_8UC3);
+	for (int y = 0; y < frameHeight; ++y) {
+		uchar* row = bgr.ptr<uchar>(y);
+		for (int x = 0; x < frameWidth; ++x) {
+			row[3 * x] = (uchar)(64 + (x * 128) / std::max(1, frameWidth));
+			row[3 * x + 1] = (uchar)(64 + (y * 128) / std::max(1, frameHeight));
+			row[3 * x + 2] = (uchar)(96 + ((x + y) & 31));
+		}
+	}
+	if (!rawRetrieval) {
+		background = bgr;
+		return;
+	}
+
+	background = cv::Mat(frameHeight, frameWidth, CV_8UC2);
+	for (int y = 0; y < frameHeight; ++y) {
+		const uchar* src = bgr.ptr<uchar>(y);
+		uchar* dst = background.ptr<uchar>(y);
+		for (int x = 0; x + 1 < frameWidth; x += 2) {
+			double u = 0, v = 0;
+			for (int k = 0; k < 2; ++k) {
+				const double b = src[3 * (x + k)], g = src[3 * (x + k) + 1], r = src[3 * (x + k) + 2];
+				dst[2 * (x + k)] = (uchar)std::lround(16 + 0.257 * r + 0.504 * g + 0.098 * b);
+				u += 128 - 0.148 * r - 0.291 * g + 0.439 * b;
+				v += 128 + 0.439 * r - 0.368 * g - 0.071 * b;
+			}
+			dst[2 * x + 1] = (uchar)std::lround(u / 2);
+			dst[2 * x + 3] = (uchar)std::lround(v / 2);
+		}
+	}
+}
+
+
+/// <summary>
+/// Render a sensor frame: a static gradient background plus a slow global intensity wave, with the sensor
+///   frame index stamped in the first 4 bytes.
+/// </summary>
+void SyntheticFrameSource::renderFrame(long long sensorFrameIndex, cv::Mat& frame) {
+	const int frameType = rawRetrieval ? CV_8UC2 : CV_8UC3;
+	if (background.rows != frameHeight || background.cols != frameWidth || background.type() != frameType)
+		prepareBackground();
+
+	// About 1.2 Hz at the sensor frame rate, with an amplitude of a few intensity levels.
+	const double t = sensorFrameIndex * sensorPeriod();
+	const int offset = (int)std::lround(3.0 * std::sin(2.0 * 3.14159265358979 * 1.2 * t));
+
+	// In YUY2, only the luma bytes (even bytes) change. Background values stay far from 0 and 255,
+	//   so adding the offset never overflows.
+	const int rowBytes = frameWidth * (int)background.elemSize();
+	const int byteStep = rawRetrieval ? 2 : 1;
+	frame.create(frameHeight, frameWidth, frameType);
+	for (int y = 0; y < frameHeight; ++y) {
+		const uchar* src = background.ptr<uchar>(y);
+		uchar* dst = frame.ptr<uchar>(y);
+		memcpy(dst, src, rowBytes);
+		for (int i = 0; i < rowBytes; i += byteStep)
+			dst[i] = (uchar)(src[i] + offset);
+	}
+
+	const uint32_t stamp = (uint32_t)sensorFrameIndex;
+	uchar* first = frame.ptr<uchar>(0);
+	for (int i = 0; i < 4 && i < rowBytes; ++i)
+		first[i] = (uchar)(stamp >> (8 * i));
+}
+
+
+double SyntheticFrameSource::get(int propId) const {
+	switch (propId) {
+	case cv::CAP_PROP_FRAME_HEIGHT: return frameHeight;
+	case cv::CAP_PROP_FRAME_WIDTH: return frameWidth;
+	case cv::CAP_PROP_FPS: return 1.0 / sensorPeriod();
+	case cv::CAP_PROP_FOURCC: return cv::VideoWriter::fourcc('Y', 'U', 'Y', '2');
+	default: return 0;
+	}
+}
+
+
+bool SyntheticFrameSource::set(int propId, double value) {
+	switch (propId) {
+	case cv::CAP_PROP_FRAME_HEIGHT: frameHeight = (int)value; return true;
+	case cv::CAP_PROP_FRAME_WIDTH: frameWidth = (int)value; return true;
+	case cv::CAP_PROP_FPS:
+		if (value > 0)
+			requestedFramePerSec = value;
+		return true;
+	default: return false;  // Like a real camera, unsupported properties are ignored.
+	}
+}
@@ -0,0 +1,175 @@
+/**
+  Frame source abstraction of VidCap Pacer. The pacer grabs frames from a FrameSource instead of talking to
+    cv::VideoCapture directly, so a real camera can be swapped for a synthetic one when benchmarking the pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include "json.hpp"
+
+
+/// <summary>
+/// A device (real or simulated) that VidCap Pacer grabs frames from. The interface mirrors the part of
+///   cv::VideoCapture the pacer uses: grab() latches a frame as quickly as possible and retrieve() brings
+///   the latched frame to RAM. Properties use the cv::CAP_PROP_* identifiers.
+/// </summary>
+class FrameSource {
+public:
+	virtual ~FrameSource() = default;
+	virtual bool isOpened() const = 0;
+	virtual bool grab() = 0;
+	virtual bool retrieve(cv::Mat& frame) = 0;
+	virtual double get(int propId) const = 0;
+	virtual bool set(int propId, double value) = 0;
+
+	/// Short human-readable name of the backend, used in console messages.
+	virtual std::string backendName() const = 0;
+
+	/// <summary>
+	/// Zero-copy retrieval. A source that can lend its own buffers returns how many frames may be borrowed at
+	///   the same time from maxBorrowedFrames(). retrieveBorrowed() then makes frame a header over the device
+	///   buffer instead of copying it, and the buffer stays valid until releaseBorrowed(token) is called.
+	///   Borrowed frames are in the native device format (e.g., YUY2 as CV_8UC2).
+	/// The defaults lend nothing: retrieveBorrowed() copies through retrieve() and returns token -1.
+	/// releaseBorrowed() may be called from another thread than grab() and retrieveBorrowed().
+	/// </summary>
+	virtual int maxBorrowedFrames() const { return 0; }
+	virtual bool retrieveBorrowed(cv::Mat& frame, int& token) { token = -1; return retrieve(frame); }
+	virtual void releaseBorrowed(int /*token*/) {}
+
+	/// <summary>
+	/// Raw retrieval. When enabled, retrieve() delivers frames in the native YUY2 format of the device
+	///   (2 bytes per pixel) instead of converting them to BGR. Depending on the backend, a raw frame is either
+	///   a height x width CV_8UC2 Mat or a single row holding the same bytes.
+	/// </summary>
+	/// <returns>False if the source cannot deliver raw frames.</returns>
+	virtual bool setRawRetrieval(bool raw) { return !raw; }
+};
+
+#define shrptr_FrameSource std::shared_ptr<FrameSource>
+
+
+/// <summary>
+/// Frame source backed by cv::VideoCapture. This is the camera path VidCap Pacer has always used.
+/// </summary>
+class OpenCvFrameSource : public FrameSource {
+public:
+	explicit OpenCvFrameSource(const int camID);
+
+	bool isOpened() const override { return cap.isOpened(); }
+	bool grab() override { return cap.grab(); }
+	bool retrieve(cv::Mat& frame) override { return cap.retrieve(frame); }
+	double get(int propId) const override { return cap.get(propId); }
+	bool set(int propId, double value) override { return cap.set(propId, value); }
+	std::string backendName() const override { return "OpenCV VideoCapture"; }
+
+	/// Raw frames come from turning off CAP_PROP_CONVERT_RGB. Some backends ignore it, so the pacer checks the
+	///   size of the warm-up frames as well.
+	bool setRawRetrieval(bool raw) override { return cap.set(cv::CAP_PROP_CONVERT_RGB, raw ? 0 : 1) || !raw; }
+
+private:
+	cv::VideoCapture cap;
+};
+
+
+/// <summary>
+/// A latency distribution used by the synthetic camera. All values are in seconds.
+///   "constant": always mean.
+///   "uniform": uniform in [mean - spread, mean + spread].
+///   "normal": normal with standard deviation spread.
+///   "lognormal": log-normal whose median is mean and whose log standard deviation is spread. This gives
+///     the long right tail we see in cheap USB 2 cameras.
+/// Samples are never negative.
+/// </summary>
+struct LatencyDistribution {
+	std::string type = "constant";
+	double mean = 0.0;
+	double spread = 0.0;
+
+	double sample(std::mt19937_64& rng) const;
+	static LatencyDistribution fromJson(const nlohmann::json& j, const LatencyDistribution& defaults);
+};
+
+
+/// <summary>
+/// Settings of the synthetic camera, read from the "synthetic_camera" object of the JSON settings file.
+/// </summary>
+struct SyntheticCameraSettings {
+	/// Internal frame clock of the simulated sensor. If 0, the sensor follows the frame rate requested
+	///   through set(cv::CAP_PROP_FPS), which is what a well-behaved camera does.
+	double sensorFramePerSec = 0;
+
+	/// Time grab() takes after a sensor frame is available, and time retrieve() takes to deliver it.
+	LatencyDistribution grabLatency{ "normal", 0.0005, 0.0001 };
+	LatencyDistribution retrieveLatency{ "normal", 0.002, 0.0005 };
+
+	/// Injected stalls. A stall makes one grab() take stallDuration longer. Stalls are injected with
+	///   stallProbability per grab and, independently, on every stallEveryNFrames-th grab (0 disables).
+	double stallProbability = 0.0;
+	int stallEveryNFrames = 0;
+	double stallDuration = 0.050;
+
+	/// Seed of the latency and stall generator. The same seed gives the same sequence of injected delays.
+	unsigned long long seed = 1;
+};
+
+void readSyntheticCameraSettings(const nlohmann::json& j, SyntheticCameraSettings& settings);
+
+
+/// <summary>
+/// A deterministic camera simulator for benchmarking and regression-testing the pacer without hardware.
+/// The sensor produces frame k at k / sensorFramePerSec after the source is opened. grab() waits for a sensor
+///   frame newer than the previously grabbed one (like a camera delivering its newest frame), then adds the
+///   configured grab latency and any injected stall. retrieve() renders the latched frame and takes the
+///   configured retrieve latency.
+/// Frame content is a static gradient with a small global intensity change per sensor frame, which looks like
+///   the mostly static scenes we record. The sensor frame index is stamped in the first 4 bytes of the frame
+///   (little endian) so that skipped or repeated sensor frames can be detected in the output. Raw frames are
+///   the same scene in YUY2.
+/// </summary>
+class SyntheticFrameSource : public FrameSource {
+public:
+	SyntheticFrameSource(const SyntheticCameraSettings& settings);
+
+	bool isOpened() const override { return true; }
+	bool grab() override;
+	bool retrieve(cv::Mat& frame) override;
+	double get(int propId) const override;
+	bool set(int propId, double value) override;
+	std::string backendName() const override { return "Synthetic camera"; }
+	bool setRawRetrieval(bool raw) override { rawRetrieval = raw; return true; }
+
+	/// Index of the sensor frame latched by the last grab(), -1 before the first grab.
+	long long lastSensorFrameIndex() const { return latchedFrameIndex; }
+
+private:
+	using SteadyClock = std::chrono::steady_clock;
+
+	double sensorPeriod() const;
+	void renderFrame(long long sensorFrameIndex, cv::Mat& frame);
+	void prepareBackground();
+
+	SyntheticCameraSettings settings;
+	std::mt19937_64 rng;
+	SteadyClock::time_point sensorTime0;
+	double requestedFramePerSec = 30;
+	int frameHeight = 480;
+	int frameWidth = 640;
+	long long latchedFrameIndex = -1;
+	long long grabCount = 0;
+	bool rawRetrieval = false;
+	cv::Mat background;  // BGR, or YUY2 in raw retrieval.
+};
+
+
+/// Sleep until the given time point. The last fraction of a millisecond is spent spinning so that simulated
+///   latencies are not dominated by the scheduler.
+void sleepUntilSteadyTime(std::chrono::steady_clock::time_point deadline);
@@ -0,0 +1,44 @@
+/**
+  Live video sink of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "LiveVideoSink.h"
+
+using namespace std;
+
+
+bool LiveVideoSink::open(const std::string& pathWithoutExtension, const VideoCodec& codec,
+		const double framesPerSec, const cv::Size& size) {
+	openVideoWriter(writer, pathWithoutExtension, codec, framesPerSec, size);
+	lastFrame = cv::Mat(size, CV_8UC3, cv::Scalar::all(0));
+	nextFrameID = 0;
+	repeated = 0;
+	return writer.isOpened();
+}
+
+
+void LiveVideoSink::write(const int frameID, const cv::Mat& bgrFrame) {
+	while (nextFrameID < frameID) {  // Fill a gap with the last frame written (black before the first one).
+		writer << lastFrame;
+		nextFrameID += 1;
+		repeated += 1;
+	}
+	writer << bgrFrame;
+	bgrFrame.copyTo(lastFrame);
+	nextFrameID += 1;
+}
+
+
+void LiveVideoSink::close(const int numFrames) {
+	if (!writer.isOpened())
+		return;
+	while (nextFrameID < numFrames) {
+		writer << lastFrame;
+		nextFrameID += 1;
+		repeated += 1;
+	}
+	writer.release();
+}
@@ -0,0 +1,46 @@
+/**
+  Live video sink of VidCap Pacer. Frames are encoded into the video while they are captured, straight from the
+    frame buffer, so the video is ready when recording stops.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "VideoCodec.h"
+
+
+/// <summary>
+/// A video writer fed with BGR frames in frame order. A frame ID that skips ahead (a dropped or spilled frame)
+///   repeats the previous frame over the gap, so the video keeps the timing of the capture.
+/// Not thread-safe. The frame pool calls it from one encoder at a time.
+/// </summary>
+class LiveVideoSink {
+public:
+	/// <param name="pathWithoutExtension">The path of the video file. The extension of the container is added.</param>
+	/// <returns>False if the video file cannot be opened with this codec.</returns>
+	bool open(const std::string& pathWithoutExtension, const VideoCodec& codec, const double framesPerSec,
+		const cv::Size& size);
+
+	bool isOpened() const { return writer.isOpened(); }
+
+	/// Append frame frameID. Frames must come in increasing frame ID order.
+	void write(const int frameID, const cv::Mat& bgrFrame);
+
+	/// <summary>
+	/// Pad the video up to numFrames frames and close the file.
+	/// </summary>
+	void close(const int numFrames);
+
+	int framesWritten() const { return nextFrameID; }
+	int repeatedFrames() const { return repeated; }
+
+private:
+	cv::VideoWriter writer;
+	cv::Mat lastFrame;
+	int nextFrameID = 0;
+	int repeated = 0;
+};
@@ -0,0 +1,90 @@
+/**
+  Online calibration of the precap margins of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "MarginCalibrator.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Bounds of the margins (seconds).
+static const double minRoughMargin = 0.0002;
+static const double maxRoughMargin = 0.030;
+static const double minFineMargin = 0.0;
+static const double maxFineMargin = 0.001;
+
+// Time we want to keep for reaching the spin loop in time after waking up.
+static const double wakeGuard = 0.0001;
+// How far past the need the rough margin jumps when a frame needed more.
+static const double roughAttackGain = 1.5;
+// Fraction of the unneeded rough margin given up per frame. Small, so the margin shrinks over seconds, not frames.
+static const double roughReleaseGain = 0.02;
+// Fraction of the grab offset corrected per frame.
+static const double fineGain = 0.2;
+
+
+MarginCalibrator::MarginCalibrator(const double roughMargin, const double fineMargin) :
+		rough(std::clamp(roughMargin, minRoughMargin, maxRoughMargin)),
+		fine(std::clamp(fineMargin, minFineMargin, maxFineMargin)),
+		initialRough(roughMargin), initialFine(fineMargin),
+		minSlack(std::numeric_limits<double>::infinity()) {
+}
+
+
+void MarginCalibrator::observe(const double wakeLateness, const double wakeSlack, const double grabOffset) {
+	frameCount += 1;
+	if (!std::isnan(wakeLateness)) {
+		const double needed = std::max(0.0, wakeLateness) + wakeGuard;
+		if (needed > rough)
+			rough += roughAttackGain * (needed - rough);
+		else
+			rough -= roughReleaseGain * (rough - needed);
+		rough = std::clamp(rough, minRoughMargin, maxRoughMargin);
+	}
+	if (!std::isnan(wakeSlack)) {
+		minSlack = std::min(minSlack, wakeSlack);
+		if (wakeSlack < 0)
+			oversleepCount += 1;
+	}
+
+	// A frame that woke up after its fine margin never spun, so its offset says nothing about the fine margin.
+	if (std::isnan(wakeSlack) || wakeSlack > fine) {
+		fine = std::clamp(fine + fineGain * grabOffset, minFineMargin, maxFineMargin);
+	}
+}
+
+
+bool MarginCalibrator::readLearnedMargins(const std::string& path, double& roughMargin, double& fineMargin) {
+	ifstream f(path);
+	if (!f.is_open())
+		return false;
+	const json j = json::parse(f, nullptr, false);
+	if (j.is_discarded() || !j.contains("precap_rough_margin_time") || !j.contains("precap_fine_margin_time"))
+		return false;
+	roughMargin = j["precap_rough_margin_time"];
+	fineMargin = j["precap_fine_margin_time"];
+	return true;
+}
+
+
+void MarginCalibrator::writeLearnedMargins(const std::string& path) const {
+	json j;
+	j["precap_rough_margin_time"] = rough;
+	j["precap_fine_margin_time"] = fine;
+	j["initial_precap_rough_margin_time"] = initialRough;
+	j["initial_precap_fine_margin_time"] = initialFine;
+	j["frames"] = frameCount;
+	j["overslept_frames"] = oversleepCount;
+	if (std::isfinite(minSlack))
+		j["min_wake_slack"] = minSlack;
+	ofstream f(path);
+	f << j.dump(4) << "\n";
+}
@@ -0,0 +1,59 @@
+/**
+  Online calibration of the precap margins of VidCap Pacer. The margins are adjusted from what each frame
+    actually did while capturing, and the learned values can be carried over to the next session.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <string>
+
+
+/// <summary>
+/// Closed-loop controller of precap_rough_margin_time and precap_fine_margin_time, driven by the frame
+///   grabbing thread once per frame.
+/// Rough margin: the wake-up lateness is how much later the thread woke up than it asked to. The margin it
+///   needs is that lateness plus a small guard for reaching the spin loop. If a frame needs more than the
+///   current margin, the margin jumps past the need at once. Otherwise it moves down toward the need by a
+///   small fraction per frame, so spinning comes down to what the machine needs over a few seconds.
+/// Fine margin: the grab offset is the grabbing time minus the ideal time. Each frame that reached the spin
+///   loop in time moves the fine margin by a fraction of its offset, which drives the mean offset toward zero.
+/// Both margins stay within fixed bounds, so a single outlier cannot ruin the rest of the session.
+/// </summary>
+class MarginCalibrator {
+public:
+	MarginCalibrator(const double roughMargin, const double fineMargin);
+
+	/// <summary>
+	/// Feed the outcome of one frame.
+	/// </summary>
+	/// <param name="wakeLateness">Actual minus requested wake-up time (seconds), NaN if the thread did not
+	///   sleep.</param>
+	/// <param name="wakeSlack">Time left before the ideal time when the thread woke up (seconds), negative if
+	///   it overslept the ideal time, NaN if it did not sleep.</param>
+	/// <param name="grabOffset">Grabbing time minus the ideal time (seconds).</param>
+	void observe(const double wakeLateness, const double wakeSlack, const double grabOffset);
+
+	double roughMargin() const { return rough; }
+	double fineMargin() const { return fine; }
+
+	/// <summary>
+	/// Read margins learned in an earlier session.
+	/// </summary>
+	/// <returns>False if the file does not exist or has no margins. The margins are then unchanged.</returns>
+	static bool readLearnedMargins(const std::string& path, double& roughMargin, double& fineMargin);
+
+	/// Write the learned margins and a few statistics of this session as JSON.
+	void writeLearnedMargins(const std::string& path) const;
+
+private:
+	double rough;
+	double fine;
+	double initialRough;
+	double initialFine;
+	double minSlack;
+	long long frameCount = 0;
+	long long oversleepCount = 0;
+};
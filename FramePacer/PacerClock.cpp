@@ -0,0 +1,220 @@
+/**
+  Clock layer of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "PacerClock.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <omp.h>
+#include <fmt/core.h>
+#ifdef __linux__
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VIDCAP_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+using namespace std;
+
+
+static double readOmpClock() {
+	return omp_get_wtime();
+}
+
+
+static double readSteadyClock() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+#ifdef __linux__
+static double readMonotonicRawClock() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+
+/// The clock the TSC is calibrated against, and the reference of the benchmark.
+static double readReferenceClock() {
+#ifdef __linux__
+	return readMonotonicRawClock();
+#else
+	return readSteadyClock();
+#endif
+}
+
+
+#ifdef VIDCAP_X86
+
+// Set by calibrateTsc(). Times are counted from the calibration, so the double keeps sub-nanosecond precision.
+static uint64_t tscOrigin = 0;
+static double tscSecondsPerTick = 0;
+static double tscTicksPerSecond = 0;
+
+
+/// An invariant TSC ticks at a constant rate in every P-, C-, and T-state, so it can serve as a wall clock.
+static bool cpuHasInvariantTsc() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0x80000000);
+	if ((unsigned)info[0] < 0x80000007u)
+		return false;
+	__cpuid(info, 0x80000007);
+	return (info[3] & (1 << 8)) != 0;
+#else
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if (__get_cpuid_max(0x80000000u, nullptr) < 0x80000007u)
+		return false;
+	__get_cpuid(0x80000007u, &eax, &ebx, &ecx, &edx);
+	return (edx & (1u << 8)) != 0;
+#endif
+}
+
+
+static double readTscClock() {
+	return (double)(int64_t)(__rdtsc() - tscOrigin) * tscSecondsPerTick;
+}
+
+
+/// <summary>
+/// Measure the TSC rate against the reference clock over about 50 ms. Each end point is the reading with the
+///   tightest bracket of reference reads out of a few, which keeps the error around 1 ppm.
+/// </summary>
+static void calibrateTsc() {
+	auto sample = [](uint64_t& tsc, double& reference) {
+		double bestWidth = 1e9;
+		for (int i = 0; i < 16; ++i) {
+			const double before = readReferenceClock();
+			const uint64_t t = __rdtsc();
+			const double after = readReferenceClock();
+			if (after - before < bestWidth) {
+				bestWidth = after - before;
+				tsc = t;
+				reference = (before + after) / 2;
+			}
+		}
+	};
+	uint64_t tsc0 = 0, tsc1 = 0;
+	double ref0 = 0, ref1 = 0;
+	sample(tsc0, ref0);
+	while (readReferenceClock() - ref0 < 0.050) {
+		continue;
+	}
+	sample(tsc1, ref1);
+	tscTicksPerSecond = (double)(tsc1 - tsc0) / (ref1 - ref0);
+	tscSecondsPerTick = 1.0 / tscTicksPerSecond;
+	tscOrigin = tsc1;
+}
+
+#endif
+
+
+struct PacerClock {
+	string name;
+	double (*read)();
+};
+
+
+static vector<PacerClock> supportedClocks() {
+	vector<PacerClock> clocks;
+#ifdef VIDCAP_X86
+	if (cpuHasInvariantTsc())
+		clocks.push_back({ "tsc", readTscClock });
+#endif
+#ifdef __linux__
+	clocks.push_back({ "monotonic_raw", readMonotonicRawClock });
+#endif
+	clocks.push_back({ "steady", readSteadyClock });
+	clocks.push_back({ "omp", readOmpClock });
+	return clocks;
+}
+
+
+double (*pacerClockReader)() = readOmpClock;
+static string activeClockName = "omp";
+
+
+bool setPacerClock(const string& name) {
+	for (const PacerClock& clock : supportedClocks()) {
+		if (name == "auto" || name == clock.name) {
+#ifdef VIDCAP_X86
+			if (clock.name == "tsc")
+				calibrateTsc();
+#endif
+			pacerClockReader = clock.read;
+			activeClockName = clock.name;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+string pacerClockName() {
+	return activeClockName;
+}
+
+
+vector<string> supportedPacerClocks() {
+	vector<string> names;
+	for (const PacerClock& clock : supportedClocks())
+		names.push_back(clock.name);
+	return names;
+}
+
+
+void benchmarkPacerClocks() {
+#ifdef VIDCAP_X86
+	if (cpuHasInvariantTsc()) {
+		calibrateTsc();
+		fmt::print("Invariant TSC: {:.6f} GHz\n", tscTicksPerSecond * 1e-9);
+	}
+	else {
+		fmt::print("No invariant TSC on this CPU.\n");
+	}
+#endif
+
+	const int reads = 2000000;
+	for (const PacerClock& clock : supportedClocks()) {
+		// Read cost: back-to-back reads, like the spin loop before each grab does.
+		volatile double sink = 0;
+		const double ref0 = readReferenceClock();
+		for (int i = 0; i < reads; ++i)
+			sink = clock.read();
+		(void)sink;  // Only there so that the reads are not optimized away.
+		const double nsPerRead = (readReferenceClock() - ref0) * 1e9 / reads;
+
+		// Observed resolution: the smallest step between two consecutive different readings.
+		double resolution = 1e9;
+		double previous = clock.read();
+		for (int i = 0; i < reads / 10; ++i) {
+			const double t = clock.read();
+			if (t > previous)
+				resolution = std::min(resolution, t - previous);
+			previous = t;
+		}
+
+		// Rate error against the reference clock over about 100 ms.
+		const double clock0 = clock.read(), reference0 = readReferenceClock();
+		while (readReferenceClock() - reference0 < 0.100) {
+			continue;
+		}
+		const double ppm = ((clock.read() - clock0) / (readReferenceClock() - reference0) - 1) * 1e6;
+		fmt::print("{:>14}: {:7.1f} ns per read, resolution {:8.1f} ns, rate error {:+7.1f} ppm\n",
+			clock.name, nsPerRead, resolution * 1e9, ppm);
+	}
+	fmt::print("\"pacer_clock\": \"auto\" picks {}.\n", supportedClocks().front().name);
+}
@@ -0,0 +1,45 @@
+/**
+  Clock layer of VidCap Pacer. All frame timing reads one selectable high-resolution clock, so the spin loop before
+    each grab can use the cheapest accurate clock of the machine.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/// Reader of the active clock. Use pacerNow() instead.
+extern double (*pacerClockReader)();
+
+/// <summary>
+/// Current time in seconds from an arbitrary, fixed origin, read from the active clock. Only differences are
+///   meaningful, and only between readings of the same clock.
+/// </summary>
+inline double pacerNow() {
+	return pacerClockReader();
+}
+
+/// <summary>
+/// Select the clock by name: "auto" (the cheapest accurate one available), "tsc" (invariant time stamp counter,
+///   x86 only, calibrated at selection), "monotonic_raw" (CLOCK_MONOTONIC_RAW, Linux only), "steady"
+///   (std::chrono::steady_clock), or "omp" (omp_get_wtime, which earlier versions used).
+/// Select the clock before capture starts. Times read from different clocks cannot be compared.
+/// </summary>
+/// <returns>False if the clock is unknown or not available here. The selection is then unchanged.</returns>
+bool setPacerClock(const std::string& name);
+
+/// Name of the clock in use.
+std::string pacerClockName();
+
+/// Names of the clocks available here, preferred first.
+std::vector<std::string> supportedPacerClocks();
+
+/// <summary>
+/// Measure the read cost and the observed resolution of every available clock, and check the TSC calibration
+///   against CLOCK_MONOTONIC_RAW (or steady_clock). Used by the --benchmark-clocks command.
+/// </summary>
+void benchmarkPacerClocks();
@@ -0,0 +1,157 @@
+/**
+  PNG encoding of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "PngEncoding.h"
+#include "PacerClock.h"
+#include "FrameCodec.h"
+#include <opencv2/opencv.hpp>
+#include <fmt/core.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Row filters are exposed by OpenCV 4.11 and later.
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 11)
+#define VIDCAP_PNG_FILTERS 1
+#endif
+
+
+struct NamedValue {
+	const char* name;
+	int value;
+};
+
+static const NamedValue pngStrategies[] = {
+	{ "default", cv::IMWRITE_PNG_STRATEGY_DEFAULT },
+	{ "filtered", cv::IMWRITE_PNG_STRATEGY_FILTERED },
+	{ "huffman_only", cv::IMWRITE_PNG_STRATEGY_HUFFMAN_ONLY },
+	{ "rle", cv::IMWRITE_PNG_STRATEGY_RLE },
+	{ "fixed", cv::IMWRITE_PNG_STRATEGY_FIXED },
+};
+
+#ifdef VIDCAP_PNG_FILTERS
+static const NamedValue pngFilters[] = {
+	{ "none", cv::IMWRITE_PNG_FILTER_NONE },
+	{ "sub", cv::IMWRITE_PNG_FILTER_SUB },
+	{ "up", cv::IMWRITE_PNG_FILTER_UP },
+	{ "avg", cv::IMWRITE_PNG_FILTER_AVG },
+	{ "paeth", cv::IMWRITE_PNG_FILTER_PAETH },
+	{ "fast", cv::IMWRITE_PNG_FAST_FILTERS },
+	{ "all", cv::IMWRITE_PNG_ALL_FILTERS },
+};
+#endif
+
+
+template <size_t N>
+static const NamedValue* findNamedValue(const NamedValue (&values)[N], const string& name) {
+	for (const NamedValue& v : values) {
+		if (name == v.name)
+			return &v;
+	}
+	return nullptr;
+}
+
+
+void readPngEncodingSettings(const json& j, PngEncodingSettings& settings) {
+	settings.compression = j.value("compression", settings.compression);
+	settings.strategy = j.value("strategy", settings.strategy);
+	settings.filter = j.value("filter", settings.filter);
+}
+
+
+string PngEncodingSettings::summary() const {
+	return fmt::format("compression {}, strategy {}, filter {}", compression < 0 ? "default" : to_string(compression),
+		strategy.empty() ? "default" : strategy, filter.empty() ? "default" : filter);
+}
+
+
+vector<int> pngWriteParams(const PngEncodingSettings& settings) {
+	vector<int> params;
+	if (settings.compression >= 0)
+		params.insert(params.end(), { cv::IMWRITE_PNG_COMPRESSION, min(settings.compression, 9) });
+	if (!settings.strategy.empty()) {
+		const NamedValue* strategy = findNamedValue(pngStrategies, settings.strategy);
+		if (strategy != nullptr)
+			params.insert(params.end(), { cv::IMWRITE_PNG_STRATEGY, strategy->value });
+		else
+			fmt::print("Unknown PNG strategy \"{}\". The OpenCV default is used.\n", settings.strategy);
+	}
+	if (!settings.filter.empty()) {
+#ifdef VIDCAP_PNG_FILTERS
+		const NamedValue* filter = findNamedValue(pngFilters, settings.filter);
+		if (filter != nullptr)
+			params.insert(params.end(), { cv::IMWRITE_PNG_FILTER, filter->value });
+		else
+			fmt::print("Unknown PNG filter \"{}\". The OpenCV default is used.\n", settings.filter);
+#else
+		fmt::print("PNG filters need OpenCV 4.11 or later. The OpenCV default is used.\n");
+#endif
+	}
+	return params;
+}
+
+
+bool benchmarkPngEncoding(const std::vector<std::string>& imagePaths) {
+	vector<cv::Mat> samples;
+	for (const string& path : imagePaths) {
+		cv::Mat image = cv::imread(path, cv::IMREAD_UNCHANGED);
+		if (image.empty()) {
+			fmt::print("Cannot read {}\n", path);
+			return false;
+		}
+		samples.push_back(image);
+	}
+	if (samples.empty()) {
+		fmt::print("No image given. Encoding a synthetic 1920x1080 frame; pass saved frames for real numbers.\n");
+		samples.push_back(sampleCameraFrame(cv::Size(1920, 1080), CV_8UC3));
+	}
+	double rawBytes = 0;
+	for (const cv::Mat& s : samples)
+		rawBytes += (double)s.total() * s.elemSize();
+	fmt::print("{} sample frame(s), {:.1f} MB raw. Single thread, so the speeds are per core.\n",
+		samples.size(), rawBytes / 1e6);
+
+	// Row filters, if this OpenCV has them. A negative value leaves the filters to OpenCV.
+	vector<NamedValue> filters = { { "default", -1 } };
+#ifdef VIDCAP_PNG_FILTERS
+	filters.assign(begin(pngFilters), end(pngFilters));
+#else
+	fmt::print("PNG filters need OpenCV 4.11 or later. Only the OpenCV default filters are measured.\n");
+#endif
+
+	// Encode the samples at least a few times, so that small frames are timed over more than a few milliseconds.
+	//   With every filter there are several times more settings, so each is timed over fewer rounds.
+	const int rounds = max(1, (int)(3 * 6e6 / rawBytes / filters.size()));
+	vector<uchar> buffer;
+	fmt::print("{:>11} {:>13} {:>8} {:>9} {:>11} {:>7}\n", "compression", "strategy", "filter", "MB/s", "frames/s",
+		"ratio");
+	for (int level = 0; level <= 9; ++level) {
+		for (const NamedValue& strategy : pngStrategies) {
+			for (const NamedValue& filter : filters) {
+				vector<int> params = { cv::IMWRITE_PNG_COMPRESSION, level, cv::IMWRITE_PNG_STRATEGY, strategy.value };
+#ifdef VIDCAP_PNG_FILTERS
+				if (filter.value >= 0)
+					params.insert(params.end(), { cv::IMWRITE_PNG_FILTER, filter.value });
+#endif
+				double encodedBytes = 0;
+				const double t0 = pacerNow();
+				for (int r = 0; r < rounds; ++r) {
+					for (const cv::Mat& s : samples) {
+						cv::imencode(".png", s, buffer, params);
+						encodedBytes += (double)buffer.size();
+					}
+				}
+				const double seconds = pacerNow() - t0;
+				fmt::print("{:>11} {:>13} {:>8} {:9.1f} {:11.1f} {:7.2f}\n", level, strategy.name, filter.name,
+					rawBytes * rounds / seconds / 1e6, samples.size() * rounds / seconds,
+					rawBytes * rounds / encodedBytes);
+			}
+		}
+	}
+	fmt::print("An I/O thread keeps up if its frames/s is above the target frame rate divided by encoder_threads.\n");
+	return true;
+}
@@ -0,0 +1,43 @@
+/**
+  PNG encoding of VidCap Pacer: compression level, zlib strategy, and row filters of the saved frames, and a
+    benchmark telling how fast one core encodes frames with each setting.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+
+/// <summary>
+/// Settings of the "png_encoding" JSON object. The defaults leave every parameter to OpenCV.
+/// </summary>
+struct PngEncodingSettings {
+	int compression = -1;          // zlib level 0 (none) to 9 (smallest). -1 keeps the OpenCV default.
+	std::string strategy = "";     // "default", "filtered", "huffman_only", "rle", "fixed", or "" for OpenCV's.
+	std::string filter = "";       // "none", "sub", "up", "avg", "paeth", "fast", "all", or "" for OpenCV's.
+
+	std::string summary() const;
+};
+
+void readPngEncodingSettings(const nlohmann::json& j, PngEncodingSettings& settings);
+
+/// <summary>
+/// The imwrite parameters of the settings. Settings this OpenCV build does not support (row filters need
+///   OpenCV 4.11) are reported and left out.
+/// </summary>
+std::vector<int> pngWriteParams(const PngEncodingSettings& settings);
+
+/// <summary>
+/// Encode sample frames with every compression level, strategy, and row filter (filters need OpenCV 4.11) on one
+///   thread, and print the encoding speed (MB/s and frames per second per core) and the compression ratio of each
+///   setting.
+/// </summary>
+/// <param name="imagePaths">Frames to encode, ideally frames saved by an earlier session. If empty, a synthetic
+///   1920x1080 frame with a gradient and sensor-like noise is used.</param>
+/// <returns>False if an image cannot be read.</returns>
+bool benchmarkPngEncoding(const std::vector<std::string>& imagePaths);
@@ -0,0 +1,80 @@
+/**
+  Prefetch pipeline of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "PrefetchPipeline.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+void prefetchInOrder(const int numFrames, const int readerThreads, const int window,
+		const std::function<bool(int frameID, cv::Mat& frame)>& readFrame,
+		const std::function<void(int frameID, bool hasFrame, cv::Mat& frame)>& consumeFrame) {
+	const int numReaders = max(1, readerThreads);
+	const int numSlots = max(numReaders, window);
+
+	// Frame i goes to slot i % numSlots. A reader may take frame i only once the consumer has taken frame
+	//   i - numSlots out of that slot. Reading and consuming take milliseconds per frame, so a mutex and two
+	//   condition variables cost nothing here.
+	enum SlotState : unsigned char { Empty, Read, Missing };
+	vector<cv::Mat> frames(numSlots);
+	vector<unsigned char> states(numSlots, Empty);
+	mutex m;
+	condition_variable slotFreed;
+	condition_variable frameRead;
+	int nextToRead = 0;
+	int nextToConsume = 0;
+
+	auto reader = [&]() {
+		cv::Mat frame;
+		while (true) {
+			int frameID;
+			{
+				unique_lock<mutex> lock(m);
+				slotFreed.wait(lock, [&] { return nextToRead >= numFrames || nextToRead < nextToConsume + numSlots; });
+				if (nextToRead >= numFrames)
+					return;
+				frameID = nextToRead++;
+			}
+			// Read outside the lock into a thread-local Mat, then swap it into the slot.
+			const bool ok = readFrame(frameID, frame);
+			{
+				lock_guard<mutex> lock(m);
+				const int slot = frameID % numSlots;
+				cv::swap(frames[slot], frame);
+				states[slot] = ok ? Read : Missing;
+			}
+			frameRead.notify_one();
+		}
+	};
+
+	vector<thread> readers;
+	for (int i = 0; i < numReaders; ++i)
+		readers.emplace_back(reader);
+
+	cv::Mat frame;
+	for (int frameID = 0; frameID < numFrames; ++frameID) {
+		const int slot = frameID % numSlots;
+		bool hasFrame;
+		{
+			unique_lock<mutex> lock(m);
+			frameRead.wait(lock, [&] { return states[slot] != Empty; });
+			hasFrame = states[slot] == Read;
+			cv::swap(frames[slot], frame);
+			states[slot] = Empty;
+			nextToConsume = frameID + 1;
+		}
+		slotFreed.notify_all();
+		consumeFrame(frameID, hasFrame, frame);
+	}
+	for (thread& t : readers)
+		t.join();
+}
@@ -0,0 +1,29 @@
+/**
+  Prefetch pipeline of VidCap Pacer. Frames are read (decoded) by several threads ahead of a single consumer, which
+    gets them back in frame order. This lets the post-capture video export decode frame N+k while frame N is being
+    encoded.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+
+
+/// <summary>
+/// Read frames 0 to numFrames-1 with readerThreads threads and pass them to consumeFrame in frame order on the
+///   calling thread. At most window frames are read ahead of the consumer, which bounds the memory used.
+/// </summary>
+/// <param name="numFrames">Number of frames.</param>
+/// <param name="readerThreads">Number of reading threads (at least 1).</param>
+/// <param name="window">Largest number of frames read but not consumed yet (at least readerThreads).</param>
+/// <param name="readFrame">Reads frame frameID into frame. Returns false if there is no such frame. Called
+///   concurrently, each time with a different frame.</param>
+/// <param name="consumeFrame">Gets each frame in order, with hasFrame false where readFrame failed. It may keep
+///   the frame by swapping it with another Mat, which is then reused for reading.</param>
+void prefetchInOrder(const int numFrames, const int readerThreads, const int window,
+	const std::function<bool(int frameID, cv::Mat& frame)>& readFrame,
+	const std::function<void(int frameID, bool hasFrame, cv::Mat& frame)>& consumeFrame);
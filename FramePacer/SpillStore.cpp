@@ -0,0 +1,229 @@
+/**
+  Spill store of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "SpillStore.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const size_t recordAlignment = 4096;  // Records start on a page, so a frame never shares one.
+
+
+SpillStore::~SpillStore() {
+	close();
+}
+
+
+#ifdef _WIN32
+
+bool SpillStore::open(const std::string& path, const int rows, const int cols, const int type,
+		const size_t capacityBytes) {
+	close();
+	recordBytes = ((size_t)rows * cols * CV_ELEM_SIZE(type) + recordAlignment - 1) / recordAlignment * recordAlignment;
+	const size_t count = max((size_t)1, capacityBytes / recordBytes);
+	mappedBytes = count * recordBytes;
+	frameRows = rows;
+	frameCols = cols;
+	frameType = type;
+	// The file is deleted when its last handle is closed, even if the program crashes.
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	fileHandle = file;
+	// The mapping extends the file to its full size.
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)mappedBytes >> 32),
+		(DWORD)(mappedBytes & 0xffffffff), nullptr);
+	if (mappingHandle != nullptr)
+		mapped = (unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, mappedBytes);
+	if (mapped == nullptr) {
+		close();
+		return false;
+	}
+	filePath = path;
+	vector<Record>(count).swap(records);
+	for (size_t i = 0; i < count; ++i)
+		records[i].frame = cv::Mat(frameRows, frameCols, frameType, mapped + i * recordBytes);
+	prefault();
+	return true;
+}
+
+
+void SpillStore::close() {
+	if (mapped != nullptr)
+		UnmapViewOfFile(mapped);
+	if (mappingHandle != nullptr)
+		CloseHandle(mappingHandle);
+	if (fileHandle != nullptr)
+		CloseHandle(fileHandle);
+	mapped = nullptr;
+	mappingHandle = fileHandle = nullptr;
+	mappedBytes = 0;
+	records.clear();
+	nextToFill = 0;
+	published = claimed = 0;
+	inUse = 0;
+}
+
+#else
+
+bool SpillStore::open(const std::string& path, const int rows, const int cols, const int type,
+		const size_t capacityBytes) {
+	close();
+	recordBytes = ((size_t)rows * cols * CV_ELEM_SIZE(type) + recordAlignment - 1) / recordAlignment * recordAlignment;
+	const size_t count = max((size_t)1, capacityBytes / recordBytes);
+	mappedBytes = count * recordBytes;
+	frameRows = rows;
+	frameCols = cols;
+	frameType = type;
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	filePath = path;
+	// Allocate the blocks now, so that a full disk shows up here and not as a SIGBUS while capturing.
+	bool allocated = false;
+#ifdef __linux__
+	const int error = posix_fallocate(fd, 0, (off_t)mappedBytes);
+	allocated = error == 0;
+	if (error != 0 && error != EOPNOTSUPP && error != EINVAL) {
+		close();
+		return false;
+	}
+#endif
+	// File systems without fallocate get a sparse file.
+	if (!allocated && ftruncate(fd, (off_t)mappedBytes) != 0) {
+		close();
+		return false;
+	}
+	void* block = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (block == MAP_FAILED) {
+		close();
+		return false;
+	}
+	mapped = (unsigned char*)block;
+	vector<Record>(count).swap(records);
+	for (size_t i = 0; i < count; ++i)
+		records[i].frame = cv::Mat(frameRows, frameCols, frameType, mapped + i * recordBytes);
+	prefault();
+	return true;
+}
+
+
+void SpillStore::close() {
+	if (mapped != nullptr)
+		munmap(mapped, mappedBytes);
+	if (fd >= 0) {
+		::close(fd);
+		remove(filePath.c_str());
+	}
+	mapped = nullptr;
+	fd = -1;
+	mappedBytes = 0;
+	records.clear();
+	nextToFill = 0;
+	published = claimed = 0;
+	inUse = 0;
+}
+
+#endif
+
+
+void SpillStore::prefault() {
+#ifdef MADV_POPULATE_WRITE
+	// Linux 5.14 and later fault in the whole range at once, writable, without touching the data.
+	if (madvise(mapped, mappedBytes, MADV_POPULATE_WRITE) == 0)
+		return;
+#endif
+	// A write, so that the page is mapped writable and a later write does not fault again.
+	volatile unsigned char* p = mapped;
+	for (size_t offset = 0; offset < mappedBytes; offset += recordAlignment)
+		p[offset] = 0;
+}
+
+
+cv::Mat* SpillStore::acquireForFilling() {
+	if (records.empty())
+		return nullptr;
+	Record& r = records[nextToFill % records.size()];
+	if (r.state.load(std::memory_order_acquire) != RecordState::Free)
+		return nullptr;
+	r.state.store(RecordState::Filling, std::memory_order_relaxed);
+	inUse.fetch_add(1, std::memory_order_acq_rel);
+	return &r.frame;
+}
+
+
+bool SpillStore::publish(const int frameID, const double grabTime, const double retrieveTime) {
+	const size_t index = nextToFill % records.size();
+	Record& r = records[index];
+	unsigned char* data = mapped + index * recordBytes;
+	if (r.frame.data != data) {
+		// The frame source gave the header memory of its own. Point it back at the record, and copy the frame.
+		const cv::Mat retrieved = r.frame;
+		r.frame = cv::Mat(frameRows, frameCols, frameType, data);
+		if (retrieved.rows != frameRows || retrieved.cols != frameCols || retrieved.type() != frameType) {
+			cancel();
+			return false;
+		}
+		retrieved.copyTo(r.frame);
+	}
+	r.frameID = frameID;
+	r.grabTime = grabTime;
+	r.retrieveTime = retrieveTime;
+	r.state.store(RecordState::Ready, std::memory_order_release);
+	nextToFill += 1;
+	published.store(nextToFill, std::memory_order_release);
+	return true;
+}
+
+
+void SpillStore::cancel() {
+	Record& r = records[nextToFill % records.size()];
+	r.state.store(RecordState::Free, std::memory_order_release);
+	inUse.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+
+SpillStore::Record* SpillStore::claim() {
+	size_t c = claimed.load(std::memory_order_relaxed);
+	while (c < published.load(std::memory_order_acquire)) {
+		Record& r = records[c % records.size()];
+		if (claimed.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			r.state.store(RecordState::Encoding, std::memory_order_relaxed);
+			return &r;
+		}
+	}
+	return nullptr;
+}
+
+
+void SpillStore::release(Record& record) {
+	record.state.store(RecordState::Free, std::memory_order_release);
+	inUse.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+
+int SpillStore::drain(const std::function<void(const Record& record)>& handleFrame) {
+	int drained = 0;
+	for (Record* r = claim(); r != nullptr; r = claim()) {
+		handleFrame(*r);
+		release(*r);
+		drained += 1;
+	}
+	close();
+	return drained;
+}
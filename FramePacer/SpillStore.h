@@ -0,0 +1,119 @@
+/**
+  Spill store of VidCap Pacer. When the frame buffer is nearly full, frames are copied raw into a preallocated,
+    memory-mapped scratch file, a second tier of the buffer that extends it beyond RAM. The I/O threads drain it
+    while capture goes on, so an I/O hiccup costs disk space and some latency instead of frames.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+/// <summary>
+/// A ring of fixed-size frame records in a scratch file that is preallocated and mapped into memory when it is
+///   opened, so spilling a frame is a copy into the page cache with no encoding and no system call. The kernel
+///   writes the pages back to disk and evicts them as memory runs short.
+/// Like FramePool, it has one producer (the frame grabbing thread) and one or more encoders, and each record goes
+///   through Free -> Filling -> Ready -> Encoding -> Free. Records are freed as soon as they are encoded, in any
+///   order, and the producer fills them in sequence, so frames are claimed in the order they were spilled.
+/// </summary>
+class SpillStore {
+public:
+	enum class RecordState : int { Free, Filling, Ready, Encoding };
+
+	struct alignas(64) Record {
+		cv::Mat frame;  // Header over the record in the mapped file.
+		int frameID = -1;
+		double grabTime = 0;
+		double retrieveTime = 0;
+		std::atomic<RecordState> state{ RecordState::Free };
+	};
+
+	SpillStore() = default;
+	~SpillStore();
+	SpillStore(const SpillStore&) = delete;
+	SpillStore& operator=(const SpillStore&) = delete;
+
+	/// <summary>
+	/// Create the scratch file with room for as many frames of the given shape as fit in capacityBytes (at least
+	///   one), allocate its blocks on disk, map it, and fault in every page for writing, so that the frame grabbing
+	///   thread does not take a page fault on the first frame spilled into each record.
+	/// </summary>
+	/// <returns>False if the file cannot be created, allocated, or mapped.</returns>
+	bool open(const std::string& path, const int rows, const int cols, const int type, const size_t capacityBytes);
+
+	bool isOpen() const { return mapped != nullptr; }
+
+	/// Number of records.
+	int capacity() const { return (int)records.size(); }
+
+	/// Number of records that hold a frame or are being filled or encoded.
+	int framesInUse() const { return inUse.load(std::memory_order_acquire); }
+
+	/// Number of frames spilled and not yet claimed by an encoder.
+	int pendingFrames() const {
+		return (int)(published.load(std::memory_order_acquire) - claimed.load(std::memory_order_acquire));
+	}
+
+	/// Producer: header over the next record in sequence, or nullptr if it is still in use (the store is full).
+	cv::Mat* acquireForFilling();
+
+	/// <summary>
+	/// Producer: hand the record returned by acquireForFilling() to the encoders. If the frame source put the frame
+	///   elsewhere (a backend that reallocates the frame it retrieves into), it is copied into the record when it
+	///   has the shape of the records.
+	/// </summary>
+	/// <returns>False if the frame does not fit. The record is given back then.</returns>
+	bool publish(const int frameID, const double grabTime, const double retrieveTime);
+
+	/// Producer: give back the record returned by acquireForFilling() without a frame.
+	void cancel();
+
+	/// Encoder: the oldest spilled frame, or nullptr if no frame is waiting. Safe to call from several encoders.
+	Record* claim();
+
+	/// Encoder: free a record once its frame is saved.
+	void release(Record& record);
+
+	/// <summary>
+	/// Pass every frame not claimed yet to handleFrame, in the order it was spilled, then delete the file.
+	///   Call it once the producer and the encoders have finished.
+	/// </summary>
+	/// <returns>The number of frames handled.</returns>
+	int drain(const std::function<void(const Record& record)>& handleFrame);
+
+	/// Unmap and delete the scratch file.
+	void close();
+
+private:
+	std::string filePath;
+	unsigned char* mapped = nullptr;
+	size_t mappedBytes = 0;
+	size_t recordBytes = 0;
+	int frameRows = 0;
+	int frameCols = 0;
+	int frameType = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	/// Fault in every page of the mapping for writing.
+	void prefault();
+
+	std::vector<Record> records;
+	size_t nextToFill = 0;  // Producer only.
+	alignas(64) std::atomic<size_t> published{ 0 };
+	alignas(64) std::atomic<size_t> claimed{ 0 };
+	alignas(64) std::atomic<int> inUse{ 0 };
+};
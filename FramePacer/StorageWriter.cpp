@@ -0,0 +1,416 @@
+/**
+  Storage writer of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "StorageWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fmt/core.h>
+#ifdef __linux__
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+// O_DIRECT needs the buffer address, the size, and the file offset of every write aligned to the logical block
+//   size of the device. 4 KB covers the devices in use today.
+static const size_t directAlignment = 4096;
+
+// Each of these is reported once per process, not once per writer (there is one writer per encoder thread).
+static std::atomic<bool> directRefusedReported{ false };
+static std::atomic<bool> ringUnavailableReported{ false };
+static std::atomic<bool> platformReported{ false };
+
+
+static void reportOnce(std::atomic<bool>& reported, const string& message) {
+	if (!reported.exchange(true))
+		fmt::print("{}\n", message);
+}
+
+
+void readStorageWriterSettings(const json& j, StorageWriterSettings& settings) {
+	settings.backend = j.value("backend", settings.backend);
+	settings.direct = j.value("direct", settings.direct);
+	settings.queueDepth = j.value("queue_depth", settings.queueDepth);
+	settings.chunkKB = j.value("chunk_kb", settings.chunkKB);
+	settings.fsyncIntervalMB = j.value("fsync_interval_mb", settings.fsyncIntervalMB);
+}
+
+
+string StorageWriterSettings::summary() const {
+	string s = backend;
+	if (backend == "io_uring")
+		s += fmt::format("{}, {} x {} KB in flight", direct ? " with O_DIRECT" : "", queueDepth, chunkKB);
+	if (fsyncIntervalMB > 0)
+		s += fmt::format(", flushed every {} MB", fsyncIntervalMB);
+	return s;
+}
+
+
+StorageWriter::StorageWriter(const StorageWriterSettings& settings) : settings(settings) {
+	this->settings.queueDepth = max(1, settings.queueDepth);
+	chunkBytes = ((size_t)max(4, settings.chunkKB) * 1024 + directAlignment - 1) / directAlignment * directAlignment;
+}
+
+
+StorageWriter::~StorageWriter() {
+	close();
+	tearDown();
+}
+
+
+bool StorageWriter::usesChunks() const {
+#ifdef __linux__
+	return settings.backend == "io_uring";
+#else
+	return false;
+#endif
+}
+
+
+bool StorageWriter::isOpen() const {
+	return stream != nullptr || fd >= 0;
+}
+
+
+bool StorageWriter::open(const std::string& path) {
+	close();
+	failed = false;
+	fileSize = 0;
+	if (!usesChunks()) {
+		if (settings.backend != "buffered")
+			reportOnce(platformReported, fmt::format("Storage backend \"{}\" is not available on this platform. "
+				"Buffered writes are used.", settings.backend));
+		stream = fopen(path.c_str(), "wb");
+		if (stream == nullptr)
+			return false;
+		setvbuf(stream, nullptr, _IOFBF, 1 << 20);
+		return true;
+	}
+#ifdef __linux__
+	setUp();
+	direct = settings.direct;
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
+	if (fd < 0 && direct && errno == EINVAL) {  // The file system has no O_DIRECT (e.g. tmpfs).
+		reportOnce(directRefusedReported, fmt::format("The file system of {} does not support O_DIRECT. Writes "
+			"go through the page cache.", path));
+		direct = false;
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	current = 0;
+	filled = 0;
+	nextOffset = 0;
+#endif
+	return fd >= 0;
+}
+
+
+bool StorageWriter::write(const void* data, const size_t bytes) {
+	if (!isOpen() || failed)
+		return false;
+	if (stream != nullptr) {
+		if (bytes > 0 && fwrite(data, bytes, 1, stream) != 1)
+			failed = true;
+		fileSize += bytes;
+		syncIfDue(bytes);
+		return !failed;
+	}
+	const unsigned char* p = (const unsigned char*)data;
+	size_t left = bytes;
+	while (left > 0) {
+		const size_t n = min(chunkBytes - filled, left);
+		memcpy(chunks[current] + filled, p, n);
+		filled += n;
+		p += n;
+		left -= n;
+		fileSize += n;
+		if (filled == chunkBytes && !submitChunk(chunkBytes))
+			return false;
+	}
+	return !failed;
+}
+
+
+bool StorageWriter::close() {
+	if (!isOpen())
+		return true;
+	if (stream != nullptr) {
+		const bool ok = fclose(stream) == 0 && !failed;
+		stream = nullptr;
+		return ok;
+	}
+#ifdef __linux__
+	if (filled > 0 && !failed) {
+		size_t bytes = filled;
+		if (direct) {  // Pad the last chunk to the alignment, and cut the padding off the file afterwards.
+			bytes = (filled + directAlignment - 1) / directAlignment * directAlignment;
+			memset(chunks[current] + filled, 0, bytes - filled);
+		}
+		submitChunk(bytes);
+	}
+	waitForAll();
+	if (nextOffset != fileSize && ftruncate(fd, (off_t)fileSize) != 0)
+		failed = true;
+	const bool ok = ::close(fd) == 0 && !failed;
+	fd = -1;
+	return ok;
+#else
+	return false;
+#endif
+}
+
+
+bool StorageWriter::sync() {
+	if (!isOpen())
+		return false;
+	if (stream != nullptr) {
+		if (fflush(stream) != 0)
+			failed = true;
+#ifdef __linux__
+		else if (fdatasync(fileno(stream)) != 0)
+			failed = true;
+#elif defined(_WIN32)
+		else if (_commit(_fileno(stream)) != 0)
+			failed = true;
+#endif
+		return !failed;
+	}
+#ifdef __linux__
+	if (waitForAll() && fdatasync(fd) != 0)
+		failed = true;
+#endif
+	return !failed;
+}
+
+
+#ifdef __linux__
+
+void StorageWriter::setUp() {
+	if (!chunks.empty())
+		return;
+	const int depth = settings.queueDepth;
+	for (int i = 0; i < depth; ++i) {
+		void* chunk = nullptr;
+		if (posix_memalign(&chunk, directAlignment, chunkBytes) != 0)
+			throw std::bad_alloc();
+		chunks.push_back((unsigned char*)chunk);
+	}
+	chunkOffsets.assign(depth, 0);
+	chunkSizes.assign(depth, 0);
+	inFlight.assign(depth, 0);
+#ifdef VIDCAP_WITH_LIBURING
+	const int err = io_uring_queue_init((unsigned)depth, &ring, 0);
+	if (err < 0) {
+		reportOnce(ringUnavailableReported, fmt::format("io_uring is not available ({}). Frames are written "
+			"synchronously.", strerror(-err)));
+		return;
+	}
+	ringReady = true;
+	// Registered buffers spare the kernel from mapping the chunks on every write. Without them (e.g. over
+	//   RLIMIT_MEMLOCK), plain writes are used.
+	vector<iovec> iovecs(depth);
+	for (int i = 0; i < depth; ++i)
+		iovecs[i] = { chunks[i], chunkBytes };
+	buffersRegistered = io_uring_register_buffers(&ring, iovecs.data(), (unsigned)depth) == 0;
+#else
+	reportOnce(ringUnavailableReported, "VidCap Pacer is built without io_uring (VIDCAP_WITH_LIBURING). Frames are "
+		"written synchronously.");
+#endif
+}
+
+
+void StorageWriter::tearDown() {
+#ifdef VIDCAP_WITH_LIBURING
+	if (ringReady)
+		io_uring_queue_exit(&ring);
+	ringReady = false;
+#endif
+	for (unsigned char* chunk : chunks)
+		free(chunk);
+	chunks.clear();
+}
+
+
+/// <summary>
+/// Submit the first bytes of the current chunk at the end of what was submitted so far, then make the next chunk
+///   current, waiting for it if it is still in flight.
+/// </summary>
+bool StorageWriter::submitChunk(const size_t bytes) {
+	const int chunk = current;
+	chunkOffsets[chunk] = nextOffset;
+	chunkSizes[chunk] = bytes;
+	nextOffset += bytes;
+	bool submitted = false;
+#ifdef VIDCAP_WITH_LIBURING
+	// At most queueDepth chunks are in flight, and the ring has as many entries, so there is always a free one.
+	io_uring_sqe* sqe = ringReady ? io_uring_get_sqe(&ring) : nullptr;
+	if (sqe != nullptr) {
+		if (buffersRegistered)
+			io_uring_prep_write_fixed(sqe, fd, chunks[chunk], (unsigned)bytes, chunkOffsets[chunk], chunk);
+		else
+			io_uring_prep_write(sqe, fd, chunks[chunk], (unsigned)bytes, chunkOffsets[chunk]);
+		io_uring_sqe_set_data(sqe, (void*)(intptr_t)chunk);
+		const int err = io_uring_submit(&ring);
+		submitted = err == 1;
+		inFlight[chunk] = submitted;
+		if (!submitted) {  // Drop the ring, with the entry it still holds, and write synchronously from now on.
+			fmt::print("Submitting to io_uring failed: {}. Frames are written synchronously.\n",
+				err < 0 ? strerror(-err) : "nothing submitted");
+			waitForAll();
+			io_uring_queue_exit(&ring);
+			ringReady = false;
+		}
+	}
+#endif
+	if (!submitted && !writeChunkNow(chunk))
+		failed = true;
+	current = (current + 1) % settings.queueDepth;
+	filled = 0;
+	if (inFlight[current])
+		waitForChunk(current);
+	syncIfDue(bytes);
+	return !failed;
+}
+
+
+/// <summary>
+/// Write a chunk with pwrite(), also after a short asynchronous write.
+/// </summary>
+bool StorageWriter::writeChunkNow(const int chunk) {
+	size_t done = 0;
+	while (done < chunkSizes[chunk]) {
+		// O_DIRECT takes aligned writes only. What is left of a write cut short off an aligned boundary goes
+		//   through the page cache, and so does the rest of the file.
+		const bool aligned = done % directAlignment == 0 && (chunkOffsets[chunk] + done) % directAlignment == 0 &&
+			(chunkSizes[chunk] - done) % directAlignment == 0;
+		if (direct && !aligned)
+			stopDirectWrites();
+		const ssize_t n = pwrite(fd, chunks[chunk] + done, chunkSizes[chunk] - done,
+			(off_t)(chunkOffsets[chunk] + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fmt::print("Writing to storage failed: {}\n", n < 0 ? strerror(errno) : "nothing written");
+			return false;
+		}
+		done += (size_t)n;
+	}
+	return true;
+}
+
+
+/// <summary>
+/// Clear O_DIRECT on the open file, so that writes of any size and offset are taken.
+/// </summary>
+void StorageWriter::stopDirectWrites() {
+	const int flags = fcntl(fd, F_GETFL);
+	if (flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0)
+		direct = false;
+}
+
+
+#ifdef VIDCAP_WITH_LIBURING
+
+/// <summary>
+/// Take completions until the chunk has landed. A short write is finished synchronously.
+/// </summary>
+bool StorageWriter::waitForChunk(const int chunk) {
+	while (inFlight[chunk]) {
+		io_uring_cqe* cqe = nullptr;
+		const int err = io_uring_wait_cqe(&ring, &cqe);
+		if (err == -EINTR)
+			continue;
+		if (err < 0) {
+			fmt::print("Waiting for io_uring failed: {}\n", strerror(-err));
+			inFlight.assign(inFlight.size(), 0);
+			failed = true;
+			break;
+		}
+		const int done = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+		const int res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		inFlight[done] = 0;
+		if (res < 0) {
+			fmt::print("Writing to storage failed: {}\n", strerror(-res));
+			failed = true;
+		}
+		else if ((size_t)res < chunkSizes[done]) {
+			chunkOffsets[done] += res;
+			chunkSizes[done] -= res;
+			memmove(chunks[done], chunks[done] + res, chunkSizes[done]);
+			if (!writeChunkNow(done))
+				failed = true;
+		}
+	}
+	return !failed;
+}
+
+#else
+
+/// Without io_uring, chunks are written synchronously, so none is ever in flight.
+bool StorageWriter::waitForChunk(const int) {
+	return !failed;
+}
+
+#endif
+
+
+bool StorageWriter::waitForAll() {
+	for (int i = 0; i < (int)inFlight.size(); ++i) {
+		if (inFlight[i])
+			waitForChunk(i);
+	}
+	return !failed;
+}
+
+#else
+
+void StorageWriter::setUp() {}
+void StorageWriter::tearDown() {}
+bool StorageWriter::submitChunk(const size_t) { return false; }
+bool StorageWriter::writeChunkNow(const int) { return false; }
+void StorageWriter::stopDirectWrites() {}
+bool StorageWriter::waitForChunk(const int) { return false; }
+bool StorageWriter::waitForAll() { return false; }
+
+#endif
+
+
+/// <summary>
+/// Flush to storage once fsyncIntervalMB more megabytes have been written, so that dirty pages are written back
+///   in small steps on this (I/O) thread rather than in one burst the kernel picks. On Linux, syncfs() flushes the
+///   whole file system, so the image files of other encoder threads are flushed too.
+/// </summary>
+void StorageWriter::syncIfDue(const size_t bytes) {
+	if (settings.fsyncIntervalMB <= 0)
+		return;
+	unsyncedBytes += bytes;
+	if (unsyncedBytes < ((uint64_t)settings.fsyncIntervalMB << 20))
+		return;
+	unsyncedBytes = 0;
+	if (stream != nullptr) {
+		fflush(stream);
+#ifdef __linux__
+		syncfs(fileno(stream));
+#elif defined(_WIN32)
+		_commit(_fileno(stream));
+#endif
+		return;
+	}
+#ifdef __linux__
+	waitForAll();
+	syncfs(fd);
+#endif
+}
@@ -0,0 +1,370 @@
+/**
+  Temporal-delta lossless codec of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "TemporalCodec.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VIDCAP_X86 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define VIDCAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Payload: PayloadHeader, then the residuals of all rows as one bit stream (least significant bit first).
+//   Residuals are mapped to 0..255 by zigzag (0, -1, 1, -2, ...) and coded in blocks of blockSize. Each block
+//   starts with its Rice parameter k (4 bits). A residual z is then coded as q = z >> k zero bits, a one bit, and
+//   the k low bits of z; q >= escapeZeros is coded as escapeZeros zero bits and the 8 bits of z instead.
+// A row of a key frame is predicted from the pixel to the left. A row of a delta frame starts with one bit: 1 if
+//   it is predicted from the reference frame, 0 if from the pixel to the left, whichever gives smaller residuals.
+//   A moving hand or a lighting change then costs no more than in a key frame.
+
+namespace {
+
+struct PayloadHeader {
+	char magic[2];
+	uchar key;
+	uchar reserved;
+	int32_t reference;  // Frame ID of the reference of a delta frame, -1 for a key frame.
+};
+static_assert(sizeof(PayloadHeader) == 8, "The payload layout must not depend on the compiler.");
+
+const char payloadMagic[2] = { 'T', 'D' };
+const size_t blockSize = 64;
+const int escapeZeros = 16;
+
+
+inline int countTrailingZeros(const uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i, v);
+	return (int)i;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+
+// Both bit streams move 4 or 8 bytes at a time with memcpy, which assumes a little-endian machine (x86, ARM).
+
+class BitWriter {
+public:
+	/// out must have room for every byte written plus 8.
+	explicit BitWriter(uchar* out) : p(out) {}
+
+	void put(const uint64_t bits, const int count) {  // count <= 32
+		acc |= bits << n;
+		n += count;
+		if (n >= 32) {
+			const uint32_t low = (uint32_t)acc;
+			memcpy(p, &low, 4);
+			p += 4;
+			acc >>= 32;
+			n -= 32;
+		}
+	}
+
+	/// Write the last bits. Returns the end of the stream.
+	uchar* finish() {
+		for (; n > 0; n -= 8) {
+			*p++ = (uchar)acc;
+			acc >>= 8;
+		}
+		n = 0;
+		return p;
+	}
+
+private:
+	uchar* p;
+	uint64_t acc = 0;
+	int n = 0;
+};
+
+
+class BitReader {
+public:
+	BitReader(const uchar* p, const uchar* end) : p(p), end(end) {}
+
+	/// At least 56 bits are available after this, zeros past the end of the stream.
+	void refill() {
+		if (end - p >= 8) {  // Load 8 bytes and keep the whole ones that fit.
+			uint64_t w;
+			memcpy(&w, p, 8);
+			acc |= w << n;
+			p += (63 - n) >> 3;
+			n |= 56;
+			return;
+		}
+		while (n <= 56) {
+			if (p < end)
+				acc |= (uint64_t)*p++ << n;
+			else
+				overrun += 8;
+			n += 8;
+		}
+	}
+
+	uint64_t peek() const { return acc; }
+
+	void skip(const int count) {
+		acc >>= count;
+		n -= count;
+	}
+
+	uint32_t take(const int count) {
+		const uint32_t v = (uint32_t)(acc & ((1ull << count) - 1));
+		skip(count);
+		return v;
+	}
+
+	/// Whether more bits were consumed than the stream has.
+	bool exhausted() const { return overrun > n; }
+
+private:
+	const uchar* p;
+	const uchar* end;
+	uint64_t acc = 0;
+	int n = 0;
+	int overrun = 0;
+};
+}
+
+
+/// <summary>
+/// z[i] = zigzag(cur[i] - pred[i]) for n bytes, with 16 bytes at a time where SIMD is available.
+/// </summary>
+static void zigzagResiduals(const uchar* cur, const uchar* pred, uchar* z, const size_t n) {
+	size_t i = 0;
+#if defined(VIDCAP_X86)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		const __m128i r = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(cur + i)),
+			_mm_loadu_si128((const __m128i*)(pred + i)));
+		const __m128i sign = _mm_cmpgt_epi8(zero, r);  // 0xff where r < 0
+		_mm_storeu_si128((__m128i*)(z + i), _mm_xor_si128(_mm_add_epi8(r, r), sign));
+	}
+#elif defined(VIDCAP_NEON)
+	for (; i + 16 <= n; i += 16) {
+		const int8x16_t r = vreinterpretq_s8_u8(vsubq_u8(vld1q_u8(cur + i), vld1q_u8(pred + i)));
+		const int8x16_t sign = vshrq_n_s8(r, 7);
+		vst1q_u8(z + i, vreinterpretq_u8_s8(veorq_s8(vaddq_s8(r, r), sign)));
+	}
+#endif
+	for (; i < n; ++i) {
+		const int8_t r = (int8_t)(uchar)(cur[i] - pred[i]);
+		z[i] = (uchar)((r << 1) ^ (r >> 7));
+	}
+}
+
+
+/// <summary>
+/// out[i] = pred[i] + unzigzag(z[i]) for n bytes.
+/// </summary>
+static void addResiduals(const uchar* pred, const uchar* z, uchar* out, const size_t n) {
+	size_t i = 0;
+#if defined(VIDCAP_X86)
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		const __m128i zz = _mm_loadu_si128((const __m128i*)(z + i));
+		// unzigzag(z) = (z >> 1) ^ -(z & 1). SSE2 has no 8-bit shift, so shift 16-bit lanes and mask.
+		const __m128i half = _mm_and_si128(_mm_srli_epi16(zz, 1), _mm_set1_epi8(0x7f));
+		const __m128i negOdd = _mm_sub_epi8(zero, _mm_and_si128(zz, one));
+		const __m128i r = _mm_xor_si128(half, negOdd);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(pred + i)), r));
+	}
+#elif defined(VIDCAP_NEON)
+	for (; i + 16 <= n; i += 16) {
+		const uint8x16_t zz = vld1q_u8(z + i);
+		const uint8x16_t r = veorq_u8(vshrq_n_u8(zz, 1), vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(
+			vandq_u8(zz, vdupq_n_u8(1))))));
+		vst1q_u8(out + i, vaddq_u8(vld1q_u8(pred + i), r));
+	}
+#endif
+	for (; i < n; ++i)
+		out[i] = (uchar)(pred[i] + ((z[i] >> 1) ^ -(z[i] & 1)));
+}
+
+
+/// <summary>
+/// Residuals of a row against the pixel to the left (the first pixel against 0).
+/// </summary>
+static void spatialResiduals(const uchar* row, uchar* z, const size_t rowBytes, const int cn) {
+	static const uchar zeros[16] = {};
+	zigzagResiduals(row, zeros, z, min<size_t>(cn, rowBytes));
+	if (rowBytes > (size_t)cn)
+		zigzagResiduals(row + cn, row, z + cn, rowBytes - cn);
+}
+
+
+/// <summary>
+/// Invert spatialResiduals(). Each byte depends on the one decoded just before it, so this stays scalar.
+/// </summary>
+static void addSpatialResiduals(const uchar* z, uchar* row, const size_t rowBytes, const int cn) {
+	for (size_t i = 0; i < rowBytes; ++i) {
+		const uchar pred = i < (size_t)cn ? 0 : row[i - cn];
+		row[i] = (uchar)(pred + ((z[i] >> 1) ^ -(z[i] & 1)));
+	}
+}
+
+
+static uint32_t residualSum(const uchar* z, const size_t n) {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < n; ++i)
+		sum += z[i];
+	return sum;
+}
+
+
+static void riceEncode(const uchar* z, const size_t n, BitWriter& bits) {
+	for (size_t start = 0; start < n; start += blockSize) {
+		const size_t count = min(blockSize, n - start);
+		const uint32_t sum = residualSum(z + start, count);
+		// k close to log2 of the mean residual.
+		int k = 0;
+		while (k < 7 && ((uint32_t)count << (k + 1)) <= sum)
+			k += 1;
+		bits.put((uint32_t)k, 4);
+		for (size_t i = 0; i < count; ++i) {
+			const uint32_t v = z[start + i];
+			const uint32_t q = v >> k;
+			if (q < (uint32_t)escapeZeros)  // q zeros, a one, and the k low bits, at most 23 bits in one go.
+				bits.put((1u << q) | ((v & ((1u << k) - 1)) << (q + 1)), (int)q + 1 + k);
+			else
+				bits.put((uint64_t)v << escapeZeros, escapeZeros + 8);
+		}
+	}
+}
+
+
+static bool riceDecode(BitReader& bits, uchar* z, const size_t n) {
+	for (size_t start = 0; start < n; start += blockSize) {
+		const size_t count = min(blockSize, n - start);
+		bits.refill();
+		const int k = (int)bits.take(4);
+		if (k > 7)
+			return false;
+		for (size_t i = 0; i < count; ++i) {
+			bits.refill();
+			const uint64_t window = bits.peek();
+			if ((window & ((1u << escapeZeros) - 1)) == 0) {
+				bits.skip(escapeZeros);
+				z[start + i] = (uchar)bits.take(8);
+				continue;
+			}
+			const int q = countTrailingZeros(window);
+			bits.skip(q + 1);
+			z[start + i] = (uchar)((q << k) | (k > 0 ? bits.take(k) : 0));
+		}
+	}
+	return !bits.exhausted();
+}
+
+
+void TemporalEncoder::encode(const int frameID, const cv::Mat& frame, std::vector<uchar>& encoded) {
+	const bool key = sinceKey == 0 || previousID < 0 || previous.rows != frame.rows ||
+		previous.cols != frame.cols || previous.type() != frame.type();
+	PayloadHeader header = { { payloadMagic[0], payloadMagic[1] }, (uchar)(key ? 1 : 0), 0,
+		key ? -1 : previousID };
+	const int cn = (int)frame.elemSize();
+	const size_t rowBytes = frame.cols * frame.elemSize();
+	thread_local vector<uchar> z, zTemporal;
+	z.resize(rowBytes);
+	zTemporal.resize(rowBytes);
+	// Worst case: 24 bits per residual, 4 per block, and 1 per row. The stream goes to a buffer that only grows, so that it
+	//   is not cleared for every frame, and then the used part is copied out.
+	thread_local vector<uchar> stream;
+	const size_t worstCase = frame.rows * (rowBytes * 3 + rowBytes / blockSize + 1) + 16;
+	if (stream.size() < worstCase)
+		stream.resize(worstCase);
+	BitWriter bits(stream.data());
+	for (int y = 0; y < frame.rows; ++y) {
+		const uchar* row = frame.ptr<uchar>(y);
+		spatialResiduals(row, z.data(), rowBytes, cn);
+		if (!key) {
+			zigzagResiduals(row, previous.ptr<uchar>(y), zTemporal.data(), rowBytes);
+			const bool temporal = residualSum(zTemporal.data(), rowBytes) <= residualSum(z.data(), rowBytes);
+			bits.put(temporal ? 1 : 0, 1);
+			if (temporal)
+				z.swap(zTemporal);
+		}
+		riceEncode(z.data(), rowBytes, bits);
+	}
+	const uchar* streamEnd = bits.finish();
+	encoded.resize(sizeof(header) + (streamEnd - stream.data()));
+	memcpy(encoded.data(), &header, sizeof(header));
+	memcpy(encoded.data() + sizeof(header), stream.data(), streamEnd - stream.data());
+
+	frame.copyTo(previous);
+	previousID = frameID;
+	if (key) {
+		keyCount += 1;
+		sinceKey = 0;
+	}
+	else {
+		deltaCount += 1;
+	}
+	sinceKey += 1;
+	if (sinceKey >= keyInterval)
+		sinceKey = 0;
+}
+
+
+int temporalReference(const uchar* data, const size_t bytes) {
+	PayloadHeader header;
+	if (bytes < sizeof(header))
+		return -1;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic[0] != payloadMagic[0] || header.magic[1] != payloadMagic[1] || header.key)
+		return -1;
+	return header.reference;
+}
+
+
+bool decodeTemporalFrame(const uchar* data, const size_t bytes, const int rows, const int cols, const int type,
+		const cv::Mat& reference, cv::Mat& frame) {
+	PayloadHeader header;
+	if (bytes < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic[0] != payloadMagic[0] || header.magic[1] != payloadMagic[1])
+		return false;
+	if (!header.key && (reference.rows != rows || reference.cols != cols || reference.type() != type))
+		return false;
+
+	frame.create(rows, cols, type);
+	const int cn = (int)frame.elemSize();
+	const size_t rowBytes = frame.cols * frame.elemSize();
+	thread_local vector<uchar> z;
+	z.resize(rowBytes);
+	BitReader bits(data + sizeof(header), data + bytes);
+	for (int y = 0; y < rows; ++y) {
+		bool temporal = false;
+		if (!header.key) {
+			bits.refill();
+			temporal = bits.take(1) != 0;
+		}
+		if (!riceDecode(bits, z.data(), rowBytes))
+			return false;
+		uchar* row = frame.ptr<uchar>(y);
+		if (temporal)
+			addResiduals(reference.ptr<uchar>(y), z.data(), row, rowBytes);
+		else
+			addSpatialResiduals(z.data(), row, rowBytes, cn);
+	}
+	return true;
+}
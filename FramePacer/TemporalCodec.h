@@ -0,0 +1,59 @@
+/**
+  Temporal-delta lossless codec of VidCap Pacer. rPPG recordings are mostly static scenes, so a frame differs from
+    the previous one by a few intensity levels per pixel. The codec stores a key frame every N frames, and in
+    between, only the per-pixel residuals against the previous frame, entropy-coded with adaptive Rice codes.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+
+/// <summary>
+/// Encodes a sequence of frames. A key frame is coded against the pixel to its left. Each row of a delta frame is
+///   coded against the frame encoded before it, or against the pixel to its left where that is cheaper (e.g. where
+///   the subject moved). Each payload names the frame it refers to, so frames may be encoded out of frame
+///   order (e.g. spilled frames at the end of a session) and still decode exactly.
+/// Not thread-safe: frames must be encoded one at a time, in frame order for the best ratio.
+/// </summary>
+class TemporalEncoder {
+public:
+	/// <param name="keyInterval">A key frame is stored every keyInterval frames (1 makes every frame a key frame).</param>
+	explicit TemporalEncoder(const int keyInterval = 60) : keyInterval(keyInterval) {}
+
+	void setKeyInterval(const int interval) { keyInterval = interval; }
+
+	/// <summary>
+	/// Encode a frame. A frame whose shape or type differs from the previous frame becomes a key frame.
+	/// </summary>
+	void encode(const int frameID, const cv::Mat& frame, std::vector<uchar>& encoded);
+
+	int keyFrames() const { return keyCount; }
+	int deltaFrames() const { return deltaCount; }
+
+private:
+	int keyInterval;
+	cv::Mat previous;
+	int previousID = -1;
+	int sinceKey = 0;
+	int keyCount = 0;
+	int deltaCount = 0;
+};
+
+
+/// <summary>
+/// The frame a payload refers to, or -1 for a key frame (and for a payload that is not temporal).
+/// </summary>
+int temporalReference(const uchar* data, const size_t bytes);
+
+/// <summary>
+/// Decode a payload of TemporalEncoder.
+/// </summary>
+/// <param name="reference">The decoded reference frame of a delta payload. Ignored for a key frame.</param>
+/// <returns>False if the payload is corrupt or the reference does not match.</returns>
+bool decodeTemporalFrame(const uchar* data, const size_t bytes, const int rows, const int cols, const int type,
+	const cv::Mat& reference, cv::Mat& frame);
@@ -0,0 +1,222 @@
+/**
+  Thread placement and priorities of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "ThreadTuning.h"
+#include <cstring>
+#include <fmt/core.h>
+#ifdef __linux__
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+void readThreadTuningSettings(const json& j, ThreadTuningSettings& settings) {
+	settings.grabCpus = j.value("grab_cpus", settings.grabCpus);
+	settings.ioCpus = j.value("io_cpus", settings.ioCpus);
+	settings.encoderCpus = j.value("encoder_cpus", settings.encoderCpus);
+	settings.grabSchedPolicy = j.value("grab_sched_policy", settings.grabSchedPolicy);
+	settings.grabPriority = j.value("grab_priority", settings.grabPriority);
+	settings.ioNice = j.value("io_nice", settings.ioNice);
+	settings.ioPriorityClass = j.value("io_priority_class", settings.ioPriorityClass);
+	settings.ioPriorityLevel = j.value("io_priority_level", settings.ioPriorityLevel);
+	settings.lockMemory = j.value("lock_memory", settings.lockMemory);
+}
+
+
+static string cpuListString(const vector<int>& cpus) {
+	if (cpus.empty())
+		return "any";
+	string s;
+	for (int cpu : cpus)
+		s += (s.empty() ? "" : ",") + to_string(cpu);
+	return s;
+}
+
+
+string ThreadTuningSettings::summary() const {
+	string s = fmt::format("grab CPUs {}, grab policy {}", cpuListString(grabCpus), grabSchedPolicy);
+	if (grabSchedPolicy != "other")
+		s += fmt::format(" (priority {})", grabPriority);
+	s += fmt::format(", I/O CPUs {}", cpuListString(ioCpus));
+	if (!encoderCpus.empty())
+		s += fmt::format(", encoder CPUs {}", cpuListString(encoderCpus));
+	s += fmt::format(", I/O nice {}", ioNice);
+	if (!ioPriorityClass.empty())
+		s += fmt::format(", I/O priority {}", ioPriorityClass == "idle" ? ioPriorityClass :
+			fmt::format("{} {}", ioPriorityClass, ioPriorityLevel));
+	s += fmt::format(", lock memory {}", lockMemory);
+	return s;
+}
+
+
+/// The CPUs an I/O thread may run on: its own CPU if encoder CPUs are given, otherwise the I/O CPUs.
+static vector<int> ioThreadCpus(const ThreadTuningSettings& settings, const int encoderIndex) {
+	if (settings.encoderCpus.empty())
+		return settings.ioCpus;
+	return { settings.encoderCpus[encoderIndex % settings.encoderCpus.size()] };
+}
+
+
+#ifdef __linux__
+
+// From linux/ioprio.h, which not every libc exposes.
+static const int ioprioClassShift = 13;
+static const int ioprioClassBestEffort = 2;
+static const int ioprioClassIdle = 3;
+static const int ioprioWhoProcess = 1;
+
+
+static bool pinCurrentThread(const vector<int>& cpus, const char* threadName) {
+	if (cpus.empty())
+		return true;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+		CPU_SET(cpu, &set);
+	const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0) {
+		fmt::print("Cannot pin the {} thread to CPUs {}: {}\n", threadName, cpuListString(cpus), strerror(err));
+		return false;
+	}
+	return true;
+}
+
+
+bool tuneGrabThread(const ThreadTuningSettings& settings) {
+	bool ok = pinCurrentThread(settings.grabCpus, "frame grabbing");
+	if (settings.grabSchedPolicy == "fifo" || settings.grabSchedPolicy == "rr") {
+		const int policy = settings.grabSchedPolicy == "fifo" ? SCHED_FIFO : SCHED_RR;
+		sched_param param;
+		param.sched_priority = settings.grabPriority;
+		const int err = pthread_setschedparam(pthread_self(), policy, &param);
+		if (err != 0) {
+			fmt::print("Cannot run the frame grabbing thread under SCHED_{} priority {}: {}{}\n",
+				settings.grabSchedPolicy == "fifo" ? "FIFO" : "RR", settings.grabPriority, strerror(err),
+				err == EPERM ? " (needs root or CAP_SYS_NICE)" : "");
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+bool tuneIoThread(const ThreadTuningSettings& settings, const int encoderIndex) {
+	bool ok = pinCurrentThread(ioThreadCpus(settings, encoderIndex), "I/O");
+	const pid_t tid = (pid_t)syscall(SYS_gettid);
+	// On Linux, the nice value and the I/O priority belong to each thread, not to the whole process.
+	if (settings.ioNice != 0 && setpriority(PRIO_PROCESS, tid, settings.ioNice) != 0) {
+		fmt::print("Cannot set the nice value of the I/O thread to {}: {}\n", settings.ioNice, strerror(errno));
+		ok = false;
+	}
+	if (settings.ioPriorityClass == "best_effort" || settings.ioPriorityClass == "idle") {
+		const int ioprio = settings.ioPriorityClass == "idle" ? ioprioClassIdle << ioprioClassShift :
+			(ioprioClassBestEffort << ioprioClassShift) | settings.ioPriorityLevel;
+		if (syscall(SYS_ioprio_set, ioprioWhoProcess, tid, ioprio) != 0) {
+			fmt::print("Cannot set the I/O priority of the I/O thread: {}\n", strerror(errno));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+bool lockProcessMemory() {
+	// Only MCL_CURRENT: with MCL_FUTURE, any later allocation beyond RLIMIT_MEMLOCK would fail.
+	if (mlockall(MCL_CURRENT) != 0) {
+		fmt::print("Cannot lock the frame buffers in memory: {}{}\n", strerror(errno),
+			errno == ENOMEM || errno == EPERM ? " (raise ulimit -l or run with CAP_IPC_LOCK)" : "");
+		return false;
+	}
+	return true;
+}
+
+#elif defined(_WIN32)
+
+static bool pinCurrentThread(const vector<int>& cpus, const char* threadName) {
+	if (cpus.empty())
+		return true;
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus)
+		mask |= (DWORD_PTR)1 << cpu;
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+		fmt::print("Cannot pin the {} thread to CPUs {}\n", threadName, cpuListString(cpus));
+		return false;
+	}
+	return true;
+}
+
+
+bool tuneGrabThread(const ThreadTuningSettings& settings) {
+	bool ok = pinCurrentThread(settings.grabCpus, "frame grabbing");
+	// Windows has no SCHED_FIFO/SCHED_RR. The closest is the time-critical priority, which is above every
+	//   normal thread of the process class.
+	if (settings.grabSchedPolicy == "fifo" || settings.grabSchedPolicy == "rr") {
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+			fmt::print("Cannot raise the priority of the frame grabbing thread\n");
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+bool tuneIoThread(const ThreadTuningSettings& settings, const int encoderIndex) {
+	bool ok = pinCurrentThread(ioThreadCpus(settings, encoderIndex), "I/O");
+	// Background mode lowers both the CPU and the I/O priority of the thread.
+	if (settings.ioNice > 0 || !settings.ioPriorityClass.empty()) {
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN)) {
+			fmt::print("Cannot lower the priority of the I/O thread\n");
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+bool lockProcessMemory() {
+	fmt::print("Locking the frame buffers in memory is not supported on this platform.\n");
+	return false;
+}
+
+#else
+
+bool tuneGrabThread(const ThreadTuningSettings& settings) {
+	if (!settings.grabCpus.empty() || settings.grabSchedPolicy != "other") {
+		fmt::print("Tuning the frame grabbing thread is not supported on this platform.\n");
+		return false;
+	}
+	return true;
+}
+
+
+bool tuneIoThread(const ThreadTuningSettings& settings, const int encoderIndex) {
+	if (!ioThreadCpus(settings, encoderIndex).empty() || settings.ioNice != 0 ||
+			!settings.ioPriorityClass.empty()) {
+		fmt::print("Tuning the I/O thread is not supported on this platform.\n");
+		return false;
+	}
+	return true;
+}
+
+
+bool lockProcessMemory() {
+	fmt::print("Locking the frame buffers in memory is not supported on this platform.\n");
+	return false;
+}
+
+#endif
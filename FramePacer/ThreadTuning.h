@@ -0,0 +1,55 @@
+/**
+  Thread placement and priorities of VidCap Pacer: CPU pinning, real-time scheduling of the frame grabbing thread,
+    lower CPU and I/O priorities of the I/O threads, and locking the frame buffers in memory.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+
+/// <summary>
+/// Settings of the "thread_tuning" JSON object. Everything is off by default, so threads run like any other
+///   thread of the process unless asked otherwise.
+/// </summary>
+struct ThreadTuningSettings {
+	std::vector<int> grabCpus;           // CPUs the frame grabbing thread may run on. Empty means any.
+	std::vector<int> ioCpus;             // CPUs the I/O threads may run on. Empty means any.
+	std::vector<int> encoderCpus;        // One CPU per encoder thread, reused round-robin. Overrides ioCpus.
+	std::string grabSchedPolicy = "other";  // "other", "fifo", or "rr".
+	int grabPriority = 50;               // Real-time priority for "fifo" and "rr" (1-99 on Linux).
+	int ioNice = 0;                      // Nice value of the I/O threads (0 keeps the default, 19 is the lowest).
+	std::string ioPriorityClass = "";    // I/O scheduling class of the I/O threads: "", "best_effort", or "idle".
+	int ioPriorityLevel = 7;             // Level within "best_effort", 0 (highest) to 7 (lowest).
+	bool lockMemory = false;             // Lock all pages of the process (frame buffers included) in RAM.
+
+	std::string summary() const;
+};
+
+void readThreadTuningSettings(const nlohmann::json& j, ThreadTuningSettings& settings);
+
+/// <summary>
+/// Apply the frame grabbing thread settings to the calling thread. A setting the OS refuses (usually for lack
+///   of privileges, e.g. SCHED_FIFO without CAP_SYS_NICE) is reported and skipped.
+/// </summary>
+/// <returns>True if every requested setting was applied.</returns>
+bool tuneGrabThread(const ThreadTuningSettings& settings);
+
+/// <summary>
+/// Apply the I/O thread settings to the calling thread. Refused settings are reported and skipped.
+/// </summary>
+/// <param name="encoderIndex">Index of the calling encoder thread, which picks its CPU from encoderCpus.</param>
+/// <returns>True if every requested setting was applied.</returns>
+bool tuneIoThread(const ThreadTuningSettings& settings, const int encoderIndex = 0);
+
+/// <summary>
+/// Lock every page the process has mapped so far in RAM, faulting in the ones not touched yet. Call it once
+///   the frame buffers are allocated, so that the frame grabbing thread never takes a page fault on them.
+/// </summary>
+/// <returns>True if the pages are locked.</returns>
+bool lockProcessMemory();
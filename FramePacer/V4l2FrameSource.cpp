@@ -0,0 +1,280 @@
+/**
+  Native Video4Linux2 frame source of VidCap Pacer (Linux only).
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "V4l2FrameSource.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#include "ColorConversion.h"
+
+using namespace std;
+
+
+/// ioctl that retries when interrupted by a signal.
+static int xioctl(int fd, unsigned long request, void* arg) {
+	int result;
+	do {
+		result = ioctl(fd, request, arg);
+	} while (result == -1 && errno == EINTR);
+	return result;
+}
+
+
+V4l2FrameSource::V4l2FrameSource(const int camID, const int requestedBufferCount) :
+		devicePath("/dev/video" + to_string(camID)), requestedBufferCount(requestedBufferCount) {
+	fd = open(devicePath.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	v4l2_capability capability;
+	memset(&capability, 0, sizeof(capability));
+	if (xioctl(fd, VIDIOC_QUERYCAP, &capability) == -1 ||
+			!(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+			!(capability.capabilities & V4L2_CAP_STREAMING)) {
+		printf("%s does not support V4L2 streaming video capture.\n", devicePath.c_str());
+		close(fd);
+		fd = -1;
+	}
+}
+
+
+V4l2FrameSource::~V4l2FrameSource() {
+	if (fd < 0)
+		return;
+	stopStreaming();
+	close(fd);
+}
+
+
+/// The device is (re)configured only when needed. get() is const but may have to apply pending settings
+///   to report what the driver actually granted.
+bool V4l2FrameSource::ensureStreaming() const {
+	V4l2FrameSource* self = const_cast<V4l2FrameSource*>(this);
+	if (self->streaming && !self->configurationChanged)
+		return true;
+	self->stopStreaming();
+	return self->startStreaming();
+}
+
+
+bool V4l2FrameSource::startStreaming() {
+	if (fd < 0)
+		return false;
+
+	v4l2_format format;
+	memset(&format, 0, sizeof(format));
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	format.fmt.pix.width = frameWidth;
+	format.fmt.pix.height = frameHeight;
+	format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	format.fmt.pix.field = V4L2_FIELD_NONE;
+	if (xioctl(fd, VIDIOC_S_FMT, &format) == -1 || format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+		printf("%s cannot capture YUYV frames at %d x %d.\n", devicePath.c_str(), frameWidth, frameHeight);
+		return false;
+	}
+	frameWidth = format.fmt.pix.width;  // The driver may adjust the size.
+	frameHeight = format.fmt.pix.height;
+	bytesPerLine = format.fmt.pix.bytesperline ? format.fmt.pix.bytesperline : frameWidth * 2;
+
+	v4l2_streamparm streamParam;
+	memset(&streamParam, 0, sizeof(streamParam));
+	streamParam.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	streamParam.parm.capture.timeperframe.numerator = 1000;
+	streamParam.parm.capture.timeperframe.denominator = (unsigned int)(framePerSec * 1000);
+	if (xioctl(fd, VIDIOC_S_PARM, &streamParam) == 0 && streamParam.parm.capture.timeperframe.numerator > 0) {
+		framePerSec = (double)streamParam.parm.capture.timeperframe.denominator /
+			streamParam.parm.capture.timeperframe.numerator;
+	}
+
+	v4l2_requestbuffers request;
+	memset(&request, 0, sizeof(request));
+	request.count = requestedBufferCount;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(fd, VIDIOC_REQBUFS, &request) == -1 || request.count < 2) {
+		printf("%s cannot allocate mmap buffers.\n", devicePath.c_str());
+		return false;
+	}
+
+	buffers.resize(request.count);
+	for (unsigned int i = 0; i < request.count; ++i) {
+		v4l2_buffer buffer;
+		memset(&buffer, 0, sizeof(buffer));
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		buffer.index = i;
+		if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) == -1)
+			return false;
+		buffers[i].length = buffer.length;
+		buffers[i].start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+		if (buffers[i].start == MAP_FAILED) {
+			buffers[i].start = nullptr;
+			return false;
+		}
+		if (!queueBuffer(i))
+			return false;
+	}
+
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(fd, VIDIOC_STREAMON, &type) == -1)
+		return false;
+	streaming = true;
+	configurationChanged = false;
+	return true;
+}
+
+
+void V4l2FrameSource::stopStreaming() {
+	if (streaming) {
+		v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		xioctl(fd, VIDIOC_STREAMOFF, &type);
+		streaming = false;
+	}
+	for (MappedBuffer& buffer : buffers) {
+		if (buffer.start != nullptr)
+			munmap(buffer.start, buffer.length);
+	}
+	buffers.clear();
+	grabbedIndex = -1;
+
+	v4l2_requestbuffers request;  // Free the driver buffers so that the format can change.
+	memset(&request, 0, sizeof(request));
+	request.count = 0;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	xioctl(fd, VIDIOC_REQBUFS, &request);
+}
+
+
+bool V4l2FrameSource::queueBuffer(int index) {
+	v4l2_buffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer.memory = V4L2_MEMORY_MMAP;
+	buffer.index = index;
+	std::lock_guard<std::mutex> lock(queueMutex);
+	return xioctl(fd, VIDIOC_QBUF, &buffer) == 0;
+}
+
+
+bool V4l2FrameSource::grab() {
+	if (!ensureStreaming())
+		return false;
+	if (grabbedIndex >= 0) {  // The previous grab was never retrieved. Give its buffer back.
+		queueBuffer(grabbedIndex);
+		grabbedIndex = -1;
+	}
+
+	v4l2_buffer buffer;
+	while (true) {
+		memset(&buffer, 0, sizeof(buffer));
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(fd, VIDIOC_DQBUF, &buffer) == 0)
+			break;
+		if (errno != EAGAIN)
+			return false;
+
+		// No filled buffer yet. Wait for one, but not forever in case the camera was unplugged.
+		pollfd pollFd = { fd, POLLIN, 0 };
+		if (poll(&pollFd, 1, 2000) <= 0) {
+			printf("Timed out waiting for a frame from %s.\n", devicePath.c_str());
+			return false;
+		}
+	}
+	grabbedIndex = buffer.index;
+	return true;
+}
+
+
+cv::Mat V4l2FrameSource::wrapBuffer(int index) const {
+	return cv::Mat(frameHeight, frameWidth, CV_8UC2, buffers[index].start, bytesPerLine);
+}
+
+
+bool V4l2FrameSource::retrieve(cv::Mat& frame) {
+	if (grabbedIndex < 0)
+		return false;
+	if (rawRetrieval)
+		wrapBuffer(grabbedIndex).copyTo(frame);
+	else
+		convertYuy2ToBgr(wrapBuffer(grabbedIndex), frame);
+	queueBuffer(grabbedIndex);
+	grabbedIndex = -1;
+	return true;
+}
+
+
+bool V4l2FrameSource::retrieveBorrowed(cv::Mat& frame, int& token) {
+	if (grabbedIndex < 0)
+		return false;
+	frame = wrapBuffer(grabbedIndex);
+	token = grabbedIndex;
+	grabbedIndex = -1;
+	return true;
+}
+
+
+void V4l2FrameSource::releaseBorrowed(int token) {
+	if (token >= 0 && token < (int)buffers.size())
+		queueBuffer(token);
+}
+
+
+/// Two buffers are kept for the driver to fill while the rest are lent out, otherwise grabbing would wait
+///   for the I/O thread.
+int V4l2FrameSource::maxBorrowedFrames() const {
+	if (!ensureStreaming())
+		return 0;
+	return std::max(0, (int)buffers.size() - 2);
+}
+
+
+double V4l2FrameSource::get(int propId) const {
+	ensureStreaming();
+	switch (propId) {
+	case cv::CAP_PROP_FRAME_HEIGHT: return frameHeight;
+	case cv::CAP_PROP_FRAME_WIDTH: return frameWidth;
+	case cv::CAP_PROP_FPS: return framePerSec;
+	case cv::CAP_PROP_FOURCC: return cv::VideoWriter::fourcc('Y', 'U', 'Y', '2');
+	default: return 0;
+	}
+}
+
+
+bool V4l2FrameSource::set(int propId, double value) {
+	switch (propId) {
+	case cv::CAP_PROP_FRAME_HEIGHT:
+		configurationChanged |= ((int)value != frameHeight);
+		frameHeight = (int)value;
+		return true;
+	case cv::CAP_PROP_FRAME_WIDTH:
+		configurationChanged |= ((int)value != frameWidth);
+		frameWidth = (int)value;
+		return true;
+	case cv::CAP_PROP_FPS:
+		if (value <= 0)
+			return false;
+		configurationChanged |= (abs(value - framePerSec) > 1e-6);
+		framePerSec = value;
+		return true;
+	default: return false;  // Only YUYV is supported, and the remaining properties are left to the driver.
+	}
+}
+
+#endif  // __linux__
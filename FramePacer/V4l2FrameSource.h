@@ -0,0 +1,79 @@
+/**
+  Native Video4Linux2 frame source of VidCap Pacer (Linux only). Frames are dequeued from mmap'd driver
+    buffers and can be handed to the I/O thread by reference, so the grabbing thread does not copy or convert
+    them.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#ifdef __linux__
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FrameSource.h"
+
+
+/// <summary>
+/// Frame source talking to /dev/video{camID} through V4L2 streaming I/O with mmap'd buffers. The device is
+///   asked for YUYV (YUY2) at the requested size and frame rate.
+/// grab() dequeues the next filled driver buffer. retrieve() converts it to BGR (or copies it as is in raw
+///   retrieval) and gives the buffer back to the driver at once, like cv::VideoCapture does.
+///   retrieveBorrowed() wraps the buffer in a CV_8UC2 header instead, and the buffer goes back to the driver
+///   only when releaseBorrowed() is called after encoding.
+/// The device is configured lazily on the first grab() or get(), so all set() calls made right after
+///   construction are applied together.
+/// </summary>
+class V4l2FrameSource : public FrameSource {
+public:
+	V4l2FrameSource(const int camID, const int requestedBufferCount);
+	~V4l2FrameSource() override;
+
+	bool isOpened() const override { return fd >= 0; }
+	bool grab() override;
+	bool retrieve(cv::Mat& frame) override;
+	double get(int propId) const override;
+	bool set(int propId, double value) override;
+	std::string backendName() const override { return "V4L2 mmap (" + devicePath + ")"; }
+
+	int maxBorrowedFrames() const override;
+	bool retrieveBorrowed(cv::Mat& frame, int& token) override;
+	void releaseBorrowed(int token) override;
+	bool setRawRetrieval(bool raw) override { rawRetrieval = raw; return true; }
+
+private:
+	struct MappedBuffer {
+		void* start = nullptr;
+		size_t length = 0;
+	};
+
+	bool ensureStreaming() const;
+	bool startStreaming();
+	void stopStreaming();
+	bool queueBuffer(int index);
+	cv::Mat wrapBuffer(int index) const;
+
+	std::string devicePath;
+	int fd = -1;
+	int requestedBufferCount;
+	std::vector<MappedBuffer> buffers;
+	bool streaming = false;
+	bool configurationChanged = true;
+
+	int frameHeight = 480;
+	int frameWidth = 640;
+	double framePerSec = 30;
+	int bytesPerLine = 0;
+	bool rawRetrieval = false;
+
+	/// Index of the buffer dequeued by the last grab() and not yet retrieved, -1 if none.
+	int grabbedIndex = -1;
+
+	/// Serializes QBUF calls coming from the grabbing thread and the I/O thread.
+	std::mutex queueMutex;
+};
+
+#endif  // __linux__
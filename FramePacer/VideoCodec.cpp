@@ -0,0 +1,57 @@
+/**
+  Video codecs of VidCap Pacer.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#include "VideoCodec.h"
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+
+static int fourccOf(const string& code) {
+	const string c = (code + "    ").substr(0, 4);
+	return cv::VideoWriter::fourcc(c[0], c[1], c[2], c[3]);
+}
+
+
+VideoCodec resolveVideoCodec(const std::string& codec, const std::string& container) {
+	string key = codec;
+	transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	VideoCodec v;
+	v.container = "avi";
+	if (key == "mjpg") {
+		v = { "MJPG", fourccOf("MJPG"), "avi", false };
+	}
+	else if (key == "ffv1") {
+		v = { "FFV1", fourccOf("FFV1"), "mkv", true };
+	}
+	else if (key == "huffyuv" || key == "hfyu") {
+		v = { "HuffYUV", fourccOf("HFYU"), "avi", true };
+	}
+	else if (key == "png" || key == "mpng") {
+		v = { "PNG", fourccOf("MPNG"), "avi", true };
+	}
+	else if (key == "raw") {  // FourCC 0 makes the FFmpeg backend write uncompressed frames.
+		v = { "raw", 0, "avi", true };
+	}
+	else {
+		v = { codec, fourccOf(codec), "avi", false };
+	}
+	if (!container.empty() && container != "auto")
+		v.container = container;
+	return v;
+}
+
+
+bool openVideoWriter(cv::VideoWriter& writer, const std::string& pathWithoutExtension, const VideoCodec& codec,
+		const double framesPerSec, const cv::Size& size) {
+	const string path = pathWithoutExtension + "." + codec.container;
+	if (codec.lossless && writer.open(path, cv::CAP_FFMPEG, codec.fourcc, framesPerSec, size, true))
+		return true;
+	return writer.open(path, codec.fourcc, framesPerSec, size, true);
+}
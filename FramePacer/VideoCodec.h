@@ -0,0 +1,40 @@
+/**
+  Video codecs of VidCap Pacer. The video_codec setting names either a preset, such as a lossless codec that makes
+    one video file enough to keep a session, or any FourCC code known to the OpenCV build.
+
+  MIT License
+  Copyright (c) 2024 Pinyo Taeprasartsit
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+
+struct VideoCodec {
+	std::string name;
+	int fourcc = 0;
+	std::string container;  // File extension without the dot.
+	bool lossless = false;
+};
+
+
+/// <summary>
+/// Resolve the video_codec setting. Presets are "mjpg", "ffv1", "huffyuv", "png" (PNG frames in the video) and
+///   "raw" (uncompressed), in any letter case. Anything else is taken as a FourCC code (padded with spaces).
+/// </summary>
+/// <param name="codec">The video_codec setting.</param>
+/// <param name="container">The video_container setting, or empty (or "auto") for the usual container of the
+///   codec: mkv for FFV1 and avi for everything else.</param>
+VideoCodec resolveVideoCodec(const std::string& codec, const std::string& container);
+
+
+/// <summary>
+/// Open a video writer for BGR frames. Lossless codecs are tried with the FFmpeg backend first, which is the
+///   one that has them, then with any backend.
+/// </summary>
+/// <param name="pathWithoutExtension">The path of the video file. The extension of the container is added.</param>
+/// <returns>False if no backend can write this codec.</returns>
+bool openVideoWriter(cv::VideoWriter& writer, const std::string& pathWithoutExtension, const VideoCodec& codec,
+	const double framesPerSec, const cv::Size& size);